@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# Compare two results.csv files written by run.sh, point by point.
+#
+# Usage: compare.sh base.csv new.csv [percent]
+#
+# Prints the total (read + write) IOPS of every point in both runs, and
+# marks the points where new is more than percent (default 5) slower.
+# Exits 1 if any point regressed, so it can gate a change.
+#
+
+if [ $# -lt 2 ]; then
+	sed -n '5,8p' "$0"
+	exit 1
+fi
+
+awk -F, -v pct="${3:-5}" '
+FNR == 1 {
+	for (i = 1; i <= NF; i++)
+		col[$i] = i
+	next
+}
+{
+	key = $col["target"] " " $col["rw"] " " $col["bs"] " " \
+		$col["ioengine"] " qd" $col["iodepth"] " j" $col["numjobs"]
+	iops = $col["read_iops"] + $col["write_iops"]
+	ver = $col["suite_version"]
+}
+FNR == NR {
+	base[key] = iops
+	base_ver = ver
+	next
+}
+{
+	if (ver != base_ver) {
+		printf("suite version %s vs %s, not comparable\n",
+			base_ver, ver) > "/dev/stderr"
+		mismatch = 1
+		exit
+	}
+	if (!(key in base))
+		next
+
+	mark = ""
+	if (iops < base[key] * (100 - pct) / 100) {
+		mark = "  REGRESSION"
+		bad++
+	}
+	diff = base[key] ? (iops - base[key]) * 100 / base[key] : 0
+	printf("%-44s %10d %10d %+7.1f%%%s\n", key, base[key], iops, diff,
+		mark)
+}
+END {
+	if (mismatch)
+		exit 2
+	exit bad ? 1 : 0
+}' "$1" "$2"
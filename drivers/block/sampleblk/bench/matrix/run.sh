@@ -0,0 +1,174 @@
+#!/bin/bash
+#
+# Sweep the sampleblk benchmark matrix with fio, one run of matrix.fio
+# per point, against the raw device and a file system on it.
+#
+# Usage: run.sh [-l label] [-o outdir]
+#
+#   -l label	name of this run, e.g. the queue_mode under test
+#   -o outdir	parent of the results directory, default ./results
+#
+# The sampleblk module must already be loaded with the parameters under
+# test, they are recorded in meta.txt. The fs target runs mkfs.ext4 on
+# the device, so never point DEV at a disk with data on it.
+#
+# Each dimension can be narrowed from the environment, e.g.
+#
+#   RW_LIST=randread BS_LIST="4k 64k" ENGINE_LIST=libaio ./run.sh -l bio
+#
+# io_uring and io_uring_poll are only in the default ENGINE_LIST when
+# fio can set up a ring on this kernel, which the 4.x kernels sampleblk
+# day3 builds on can't.
+#
+# Results go to <outdir>/<date>-<label>/: the fio json output of every
+# point in json/, and one line per point in results.csv. Compare two runs
+# with compare.sh.
+#
+
+SUITE_VERSION=1
+
+DEV=${DEV:-/dev/sampleblk1}
+MNT=${MNT:-/mnt/test}
+RUNTIME=${RUNTIME:-10}
+RW_LIST=${RW_LIST:-"read write randread randwrite randrw"}
+BS_LIST=${BS_LIST:-"512 4k 16k 64k 256k 1m"}
+ENGINE_LIST=${ENGINE_LIST:-}
+IODEPTH_LIST=${IODEPTH_LIST:-"1 8 32"}
+NUMJOBS_LIST=${NUMJOBS_LIST:-"1 4"}
+TARGET_LIST=${TARGET_LIST:-"raw fs"}
+
+label=default
+outdir=./results
+
+while getopts "l:o:" opt; do
+	case $opt in
+	l) label=$OPTARG ;;
+	o) outdir=$OPTARG ;;
+	*) sed -n '3,9p' "$0"; exit 1 ;;
+	esac
+done
+
+here=$(cd "$(dirname "$0")" && pwd)
+dir=$outdir/$(date +%Y%m%d-%H%M%S)-$label
+csv=$dir/results.csv
+
+for cmd in fio jq mkfs.ext4; do
+	if ! command -v $cmd > /dev/null; then
+		echo "run.sh: $cmd not found" >&2
+		exit 1
+	fi
+done
+
+if [ ! -b "$DEV" ]; then
+	echo "run.sh: $DEV is not a block device, load sampleblk first" >&2
+	exit 1
+fi
+
+if [ -z "$ENGINE_LIST" ]; then
+	ENGINE_LIST="sync libaio"
+	if fio --name=probe --ioengine=io_uring --filename="$DEV" \
+	       --rw=read --bs=4k --size=4k --output=/dev/null \
+	       > /dev/null 2>&1; then
+		ENGINE_LIST+=" io_uring io_uring_poll"
+	fi
+fi
+
+mkdir -p "$dir/json" || exit 1
+
+{
+	echo "suite_version $SUITE_VERSION"
+	echo "label $label"
+	echo "date $(date -R)"
+	echo "kernel $(uname -r)"
+	echo "fio $(fio --version)"
+	echo "commit $(git -C "$here" rev-parse --short HEAD 2> /dev/null)"
+	for p in /sys/module/sampleblk/parameters/*; do
+		[ -r "$p" ] && echo "param $(basename "$p") $(cat "$p")"
+	done
+} > "$dir/meta.txt"
+
+echo "suite_version,label,target,rw,bs,ioengine,iodepth,numjobs,status,\
+read_iops,read_bw_kib,read_clat_mean_ns,read_clat_p99_ns,\
+write_iops,write_bw_kib,write_clat_mean_ns,write_clat_p99_ns" > "$csv"
+
+# Summary of one direction of a fio json output
+fio_dir_fields()
+{
+	jq -r --arg d "$2" '.jobs[0][$d] |
+		[.iops, .bw, .clat_ns.mean,
+		 (.clat_ns.percentile["99.000000"] // 0)] |
+		map(. // 0 | floor) | join(",")' "$1"
+}
+
+run_point()
+{
+	local target=$1 rw=$2 bs=$3 engine=$4 qd=$5 nj=$6
+	local name=${target}_${rw}_${bs}_${engine}_qd${qd}_j${nj}
+	local job=$here/matrix.fio
+	local ioengine=$engine
+	local status=ok
+	local fields
+
+	if [ "$engine" = io_uring_poll ]; then
+		# sampleblk has no poll queue, so this shows what fio gets back
+		ioengine=io_uring
+		job=$dir/matrix_poll.fio
+		sed '/^ioengine=/a hipri=1' "$here/matrix.fio" > "$job"
+	fi
+
+	echo "$name"
+	if ! FILENAME=$filename SIZE=$size RW=$rw BS=$bs \
+	     IOENGINE=$ioengine IODEPTH=$qd NUMJOBS=$nj RUNTIME=$RUNTIME \
+	     fio --output-format=json --output="$dir/json/$name.json" \
+	     "$job" 2> "$dir/json/$name.err"; then
+		status=fail
+	fi
+	[ -s "$dir/json/$name.err" ] || rm -f "$dir/json/$name.err"
+
+	if [ $status = ok ]; then
+		fields="$(fio_dir_fields "$dir/json/$name.json" read),"
+		fields+=$(fio_dir_fields "$dir/json/$name.json" write)
+	else
+		fields="0,0,0,0,0,0,0,0"
+	fi
+
+	echo "$SUITE_VERSION,$label,$target,$rw,$bs,$engine,$qd,$nj,\
+$status,$fields" >> "$csv"
+}
+
+for target in $TARGET_LIST; do
+	case $target in
+	raw)
+		filename=$DEV
+		size=100%
+		;;
+	fs)
+		mkdir -p "$MNT"
+		mkfs.ext4 -q -F "$DEV" && mount "$DEV" "$MNT" || exit 1
+		filename=$MNT/fio.dat
+		size=2M
+		;;
+	*)
+		echo "run.sh: unknown target $target" >&2
+		continue
+		;;
+	esac
+
+	for rw in $RW_LIST; do
+	for bs in $BS_LIST; do
+	for engine in $ENGINE_LIST; do
+	for qd in $IODEPTH_LIST; do
+		# sync engines have one I/O in flight whatever iodepth says
+		[ "$engine" = sync ] && [ "$qd" != 1 ] && continue
+	for nj in $NUMJOBS_LIST; do
+		run_point $target $rw $bs $engine $qd $nj
+	done
+	done
+	done
+	done
+	done
+
+	[ $target = fs ] && umount "$MNT"
+done
+
+echo "results in $dir"
@@ -0,0 +1,204 @@
+#!/usr/bin/perl -w
+#
+# block_summary.pl - summarize block tracepoints from perf script output
+#
+# Reads what "perf script" prints for a perf record of the block
+# tracepoints, like perf_block_script_*.log of profile.sh, and reports
+# how the block layer shaped the I/O: merges, plugging, splits by the
+# caller that submitted the split bio, and the queue to issue and issue
+# to complete latencies, the Q2D and D2C of blkparse.
+#
+# USAGE: block_summary.pl [-d major,minor] [infile]
+#
+#   -d major,minor	only count this device, e.g. sampleblk's 253,1. Plugs
+#			and unplugs carry no device and are always counted.
+#
+# Splits can only be told apart by caller if the perf record used -g.
+# Without it, they are all counted under [unknown].
+#
+# Example:
+#
+#   perf record -a -g -e 'block:*' -- sleep 10
+#   perf script | ./block_summary.pl -d 253,1
+#
+
+use strict;
+use Getopt::Long;
+
+my $only_dev;
+GetOptions('d=s' => \$only_dev) or
+	die "USAGE: $0 [-d major,minor] [infile]\n";
+
+# Frames of the block core itself, the caller is the first frame below
+my $block_core = qr/^(__)?(blk_|bio_|generic_make_request|submit_bio|trace_)/;
+
+my %count;		# events per tracepoint
+my $unplug_rqs = 0;	# requests flushed by all unplugs
+my %bios_by_caller;
+my %splits_by_caller;
+my %q_time;		# "dev sector" of a queued bio -> time
+my %d_time;		# "dev sector" of an issued request -> time
+my @q2d;		# latencies in us
+my @d2c;
+
+my ($event, $time, $dev, $rwbs, $sector, $len);
+my @stack;
+
+sub caller_of {
+	foreach my $frame (@stack) {
+		return $frame unless $frame =~ $block_core;
+	}
+	return "[unknown]";
+}
+
+# Called once the call chain of an event, if any, has been read
+sub flush_event {
+	return unless defined $event;
+
+	if ($event eq "block_bio_queue") {
+		$bios_by_caller{caller_of()}++;
+		$q_time{"$dev $sector"} //= $time;
+	} elsif ($event eq "block_split") {
+		$splits_by_caller{caller_of()}++;
+	} elsif ($event eq "block_bio_backmerge") {
+		delete $q_time{"$dev $sector"};
+	} elsif ($event eq "block_bio_frontmerge") {
+		# The request now starts at the merged bio, keep its oldest time
+		my $old = "$dev " . ($sector + $len);
+		if (defined $q_time{$old}) {
+			my $t = delete $q_time{$old};
+			$q_time{"$dev $sector"} = $t if
+				!defined $q_time{"$dev $sector"} ||
+				$t < $q_time{"$dev $sector"};
+		}
+	} elsif ($event eq "block_rq_issue") {
+		my $t = delete $q_time{"$dev $sector"};
+		push @q2d, ($time - $t) * 1e6 if defined $t;
+		$d_time{"$dev $sector"} = $time;
+	} elsif ($event eq "block_rq_complete") {
+		my $t = delete $d_time{"$dev $sector"};
+		push @d2c, ($time - $t) * 1e6 if defined $t;
+	}
+
+	undef $event;
+	@stack = ();
+}
+
+while (my $line = <>) {
+	chomp $line;
+
+	# comm pid [cpu] time: block:event: details
+	if ($line =~ /^\s*\S.*?\s+\d+\s+\[\d+\]\s+([\d.]+):\s+(?:\d+\s+)?block:(\w+):\s*(.*)$/) {
+		my ($t, $ev, $details) = ($1, $2, $3);
+
+		flush_event();
+
+		if ($ev eq "block_plug") {
+			$count{$ev}++;
+			next;
+		}
+		if ($ev eq "block_unplug") {
+			$count{$ev}++;
+			$unplug_rqs += $1 if $details =~ /\]\s+(\d+)/;
+			next;
+		}
+
+		# Everything else starts with the device and rwbs
+		next unless $details =~ /^(\d+,\d+)\s+(\S+)\s+(.*)$/;
+		($dev, $rwbs) = ($1, $2);
+		my $rest = $3;
+		next if defined $only_dev && $dev ne $only_dev;
+
+		if ($ev eq "block_split") {
+			next unless $rest =~ /^(\d+)\s+\/\s+(\d+)/;
+			($sector, $len) = ($1, $2 - $1);
+		} else {
+			# rq events have the bytes and the command before it
+			next unless $rest =~ /(\d+)\s+\+\s+(\d+)/;
+			($sector, $len) = ($1, $2);
+		}
+
+		$count{$ev}++;
+		($event, $time) = ($ev, $t);
+		next;
+	}
+
+	# A frame of the call chain: address symbol+offset (dso)
+	if (defined $event && $line =~ /^\s+[0-9a-f]+\s+([^\s+]+)/) {
+		push @stack, $1;
+		next;
+	}
+
+	flush_event() if $line =~ /^\s*$/;
+}
+flush_event();
+
+sub pct {
+	my ($a, $b) = @_;
+	return $b ? sprintf("%.1f%%", 100 * $a / $b) : "n/a";
+}
+
+# count, avg, percentiles and a log2 histogram of latencies in us
+sub print_dist {
+	my ($name, @lat) = @_;
+
+	print "\n$name latency (us):\n";
+	unless (@lat) {
+		print "  no matched events\n";
+		return;
+	}
+
+	@lat = sort { $a <=> $b } @lat;
+	my $sum = 0;
+	$sum += $_ foreach @lat;
+	printf("  count %d avg %.1f min %.1f p50 %.1f p90 %.1f p99 %.1f " .
+		"max %.1f\n", scalar(@lat), $sum / @lat, $lat[0],
+		$lat[int(@lat * 0.5)], $lat[int(@lat * 0.9)],
+		$lat[int(@lat * 0.99)], $lat[-1]);
+
+	my @hist;
+	foreach my $l (@lat) {
+		my $b = $l < 1 ? 0 : int(log($l) / log(2)) + 1;
+		$hist[$b]++;
+	}
+	my $max = 0;
+	foreach (@hist) { $max = $_ if defined $_ && $_ > $max; }
+	for (my $b = 0; $b < @hist; $b++) {
+		my $n = $hist[$b] // 0;
+		my $lo = $b ? 1 << ($b - 1) : 0;
+		printf("  %8d -> %-8d : %-8d |%-40s|\n", $lo, 1 << $b, $n,
+			"*" x int(40 * $n / $max));
+	}
+}
+
+my $bios = $count{block_bio_queue} // 0;
+my $merges = ($count{block_bio_backmerge} // 0) +
+	($count{block_bio_frontmerge} // 0);
+my $plugs = $count{block_plug} // 0;
+my $unplugs = $count{block_unplug} // 0;
+my $splits = $count{block_split} // 0;
+
+print "Events:\n";
+printf("  %-22s %d\n", $_, $count{$_}) foreach sort keys %count;
+
+print "\nMerges:\n";
+printf("  bios queued %d, back merges %d, front merges %d\n", $bios,
+	$count{block_bio_backmerge} // 0, $count{block_bio_frontmerge} // 0);
+printf("  merge ratio %s of bios, %s bios per request\n",
+	pct($merges, $bios), $count{block_getrq} ?
+	sprintf("%.2f", $bios / $count{block_getrq}) : "n/a");
+
+print "\nPlugging:\n";
+printf("  plugs %d, unplugs %d, requests per unplug %s\n", $plugs,
+	$unplugs, $unplugs ? sprintf("%.2f", $unplug_rqs / $unplugs) : "n/a");
+
+print "\nSplits by caller:\n";
+printf("  total %d, %s of bios\n", $splits, pct($splits, $bios));
+foreach my $c (sort { $splits_by_caller{$b} <=> $splits_by_caller{$a} }
+		keys %splits_by_caller) {
+	printf("  %-40s %8d  %s of its bios\n", $c, $splits_by_caller{$c},
+		pct($splits_by_caller{$c}, $bios_by_caller{$c} // 0));
+}
+
+print_dist("Queue to issue (Q2D)", @q2d);
+print_dist("Issue to complete (D2C)", @d2c);
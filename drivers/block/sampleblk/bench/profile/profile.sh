@@ -0,0 +1,165 @@
+#!/bin/bash
+#
+# Profile one fio job against sampleblk and keep the same artifacts that
+# were captured by hand in labs/lab1 and labs/lab2, so every driver change
+# can be compared profile to profile.
+#
+# Usage: profile.sh [-d seconds] [-l label] [-o outdir] jobfile
+#
+#   -d seconds	length of each phase, default 30
+#   -l label	name of this run, default the job file name
+#   -o outdir	parent of the results directory, default ./results
+#
+# The job runs once per phase, each phase stops it with SIGINT after the
+# given time, so job files that loop forever like lab1's work as is:
+#
+#   baseline	fio alone, fio_baseline.json is the unperturbed result
+#   oncpu	perf record -g of all CPUs, the flamegraph and perf report
+#   block	block tracepoint counts with perf stat, and perf record -g
+#		of the same tracepoints for call graphs and perf script,
+#		summarized by block_summary.pl
+#   latency	iosnoop of the device, and the latency heatmap
+#
+# The flamegraph needs stackcollapse-perf.pl and flamegraph.pl from
+# FlameGraph, the heatmap iosnoop from perf-tools and trace2heatmap.pl
+# from HeatMap, found in PATH or in FLAMEGRAPH_DIR, PERF_TOOLS_DIR and
+# HEATMAP_DIR. A phase whose tools are missing is skipped.
+#
+
+DEV=${DEV:-/dev/sampleblk1}
+
+TRACEPOINTS="block:block_bio_queue,block:block_getrq,block:block_plug,\
+block:block_unplug,block:block_split,block:block_bio_backmerge,\
+block:block_bio_frontmerge,block:block_rq_insert,block:block_rq_issue,\
+block:block_rq_complete"
+
+dur=30
+label=
+outdir=./results
+
+while getopts "d:l:o:" opt; do
+	case $opt in
+	d) dur=$OPTARG ;;
+	l) label=$OPTARG ;;
+	o) outdir=$OPTARG ;;
+	*) sed -n '7,11p' "$0"; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+job=$1
+if [ -z "$job" ] || [ ! -r "$job" ]; then
+	sed -n '7,11p' "$0"
+	exit 1
+fi
+name=$(basename "$job")
+label=${label:-$name}
+dir=$outdir/$(date +%Y%m%d-%H%M%S)-$label
+
+# Look a tool up in PATH, then in the given directory
+tool()
+{
+	if command -v "$1" > /dev/null; then
+		command -v "$1"
+	elif [ -n "$2" ] && [ -x "$2/$1" ]; then
+		echo "$2/$1"
+	fi
+}
+
+for cmd in fio perf timeout; do
+	if [ -z "$(tool $cmd)" ]; then
+		echo "profile.sh: $cmd not found" >&2
+		exit 1
+	fi
+done
+
+mkdir -p "$dir" || exit 1
+cp "$job" "$dir/"
+
+{
+	echo "label $label"
+	echo "job $name"
+	echo "date $(date -R)"
+	echo "kernel $(uname -r)"
+	echo "fio $(fio --version)"
+	echo "perf $(perf --version)"
+	echo "commit $(git -C "$(dirname "$0")" rev-parse --short HEAD 2> /dev/null)"
+	for p in /sys/module/sampleblk/parameters/*; do
+		[ -r "$p" ] && echo "param $(basename "$p") $(cat "$p")"
+	done
+} > "$dir/meta.txt"
+
+# The device as "major,minor" in decimal, as iosnoop and perf print it
+if [ -b "$DEV" ]; then
+	devid=$(printf "%d,%d" 0x$(stat -L -c %t "$DEV") \
+		0x$(stat -L -c %T "$DEV"))
+fi
+
+# Run the job in the background while a phase runs "$@" for dur seconds
+with_fio()
+{
+	local phase=$1
+	local pid
+
+	shift
+	echo "phase $phase"
+	timeout -s INT $((dur + 2)) fio --output-format=json \
+		--output="$dir/fio_$phase.json" "$job" > /dev/null &
+	pid=$!
+
+	# Let fio lay out its files and start the I/O first
+	sleep 1
+	"$@"
+	wait $pid
+}
+
+with_fio baseline sleep "$dur"
+
+with_fio oncpu perf record -a -g -F 997 -o "$dir/perf_oncpu.data" \
+	-- sleep "$dur" 2> /dev/null
+perf report --stdio -i "$dir/perf_oncpu.data" \
+	> "$dir/perf_record_$name.log" 2> /dev/null
+
+collapse=$(tool stackcollapse-perf.pl "$FLAMEGRAPH_DIR")
+flamegraph=$(tool flamegraph.pl "$FLAMEGRAPH_DIR")
+if [ -n "$collapse" ] && [ -n "$flamegraph" ]; then
+	perf script -i "$dir/perf_oncpu.data" 2> /dev/null | "$collapse" \
+		> "$dir/out.perf-folded"
+	"$flamegraph" --title "$label on-CPU" "$dir/out.perf-folded" \
+		> "$dir/flamegraph_on_cpu_perf_$name.svg"
+else
+	echo "profile.sh: no FlameGraph scripts, skipping the flamegraph"
+fi
+
+with_fio blockstat perf stat -a -e "$TRACEPOINTS" \
+	-o "$dir/perf_stat_block_$name.log" -- sleep "$dur"
+with_fio block perf record -a -g -e "$TRACEPOINTS" \
+	-o "$dir/perf_block.data" -- sleep "$dur" 2> /dev/null
+perf report --stdio -i "$dir/perf_block.data" \
+	> "$dir/perf_block_report_$name.log" 2> /dev/null
+perf script -i "$dir/perf_block.data" \
+	> "$dir/perf_block_script_$name.log" 2> /dev/null
+"$(dirname "$0")/block_summary.pl" ${devid:+-d $devid} \
+	"$dir/perf_block_script_$name.log" > "$dir/block_summary_$name.log"
+
+iosnoop=$(tool iosnoop "$PERF_TOOLS_DIR")
+heatmap=$(tool trace2heatmap.pl "$HEATMAP_DIR")
+if [ -n "$iosnoop" ] && [ -n "$devid" ]; then
+	with_fio latency "$iosnoop" -ts -d "$devid" "$dur" \
+		> "$dir/iosnoop_$name.log" 2> /dev/null
+
+	# Completion time in s and latency in us, as in the HeatMap docs
+	if [ -n "$heatmap" ]; then
+		awk 'NR > 2 && $NF ~ /^[0-9.]+$/ { print $2, 1000 * $NF }' \
+			"$dir/iosnoop_$name.log" | "$heatmap" \
+			--unitstime=s --unitslabel=us \
+			--titletext="$label latency" \
+			> "$dir/heatmap_latency_iosnoop_$name.svg"
+	else
+		echo "profile.sh: no trace2heatmap.pl, skipping the heatmap"
+	fi
+else
+	echo "profile.sh: no iosnoop or $DEV, skipping the latency phase"
+fi
+
+echo "results in $dir"
@@ -0,0 +1,150 @@
+/*
+ *   blk/sampleblk/cbt.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   Changed block tracking. One bit per cbt_granularity bytes of the disk
+ *   is set after data has been written there, without any lock, and
+ *   SAMPLEBLK_IOC_CBT_GET hands the bitmap to an incremental export tool,
+ *   optionally clearing it word by word with xchg. Bits are set after the
+ *   data is stored, so a region written while it is being exported is
+ *   always reported again by the next fetch.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/uaccess.h>
+#include "sample_blk.h"
+#include "sampleblk_ioctl.h"
+
+static unsigned int cbt_granularity = 64 * 1024;
+module_param(cbt_granularity, uint, 0444);
+MODULE_PARM_DESC(cbt_granularity,
+	"Bytes tracked by one bit, power of 2 >= 512, 0 disables tracking");
+
+/* Longs making up one __u64 word of the user space bitmap */
+#define SAMPLEBLK_CBT_LONGS	(64 / BITS_PER_LONG)
+
+void sampleblk_cbt_mark(struct sampleblk_dev *dev, uint64_t pos,
+		uint64_t len)
+{
+	unsigned long bit, last;
+
+	if (!dev->cbt || !len)
+		return;
+
+	bit = pos >> dev->cbt_shift;
+	last = (pos + len - 1) >> dev->cbt_shift;
+
+	/* Only dirty the cache line if the bit is not already set */
+	for (; bit <= last; bit++)
+		if (!test_bit(bit, dev->cbt))
+			set_bit(bit, dev->cbt);
+}
+
+static u64 sampleblk_cbt_fetch(struct sampleblk_dev *dev, unsigned long idx,
+		bool clear)
+{
+	unsigned long *word = &dev->cbt[idx * SAMPLEBLK_CBT_LONGS];
+	u64 v = 0;
+	int i;
+
+	for (i = 0; i < SAMPLEBLK_CBT_LONGS; i++)
+		v |= (u64)(clear ? xchg(&word[i], 0) : READ_ONCE(word[i])) <<
+			(i * BITS_PER_LONG);
+
+	return v;
+}
+
+/* Put back bits whose copy to user space failed */
+static void sampleblk_cbt_restore(struct sampleblk_dev *dev,
+		unsigned long idx, u64 v)
+{
+	unsigned long bit;
+
+	for (bit = 0; bit < 64; bit++)
+		if (v & (1ULL << bit))
+			set_bit(idx * 64 + bit, dev->cbt);
+}
+
+int sampleblk_cbt_get(struct sampleblk_dev *dev,
+		struct sampleblk_cbt __user *argp, bool writable)
+{
+	struct sampleblk_cbt c;
+	u64 __user *ubits;
+	unsigned long i, nr_words;
+	bool clear;
+	u64 v;
+
+	if (!dev->cbt)
+		return -ENODEV;
+	if (copy_from_user(&c, argp, sizeof(c)))
+		return -EFAULT;
+
+	clear = c.flags & SAMPLEBLK_CBT_CLEAR;
+	if (c.flags & ~SAMPLEBLK_CBT_CLEAR)
+		return -EINVAL;
+	if (clear && !writable)
+		return -EBADF;
+
+	ubits = u64_to_user_ptr(c.bitmap);
+	nr_words = DIV_ROUND_UP(min_t(u64, c.nr_bits, dev->cbt_bits), 64);
+	for (i = 0; i < nr_words; i++) {
+		v = sampleblk_cbt_fetch(dev, i, clear);
+		if (put_user(v, &ubits[i])) {
+			if (clear)
+				sampleblk_cbt_restore(dev, i, v);
+			return -EFAULT;
+		}
+	}
+
+	c.granularity = 1U << dev->cbt_shift;
+	c.nr_bits = dev->cbt_bits;
+	if (copy_to_user(argp, &c, sizeof(c)))
+		return -EFAULT;
+
+	return 0;
+}
+
+int sampleblk_cbt_init(struct sampleblk_dev *dev)
+{
+	unsigned long nr_words;
+
+	if (!cbt_granularity)
+		return 0;
+	if (cbt_granularity < 512 || !is_power_of_2(cbt_granularity))
+		return -EINVAL;
+
+	dev->cbt_shift = ilog2(cbt_granularity);
+	dev->cbt_bits = DIV_ROUND_UP(dev->size, cbt_granularity);
+
+	/* Whole __u64 words, so fetching never reads past the end */
+	nr_words = DIV_ROUND_UP(dev->cbt_bits, 64);
+	dev->cbt = vzalloc(nr_words * sizeof(u64));
+	if (!dev->cbt)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void sampleblk_cbt_free(struct sampleblk_dev *dev)
+{
+	vfree(dev->cbt);
+	dev->cbt = NULL;
+}
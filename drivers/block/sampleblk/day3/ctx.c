@@ -0,0 +1,134 @@
+/*
+ *   blk/sampleblk/ctx.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   Preallocated per-I/O contexts. The request_fn queue has no per-request
+ *   driver payload like a blk-mq tag set, so the driver keeps its own set
+ *   of contexts and a bitmap of the busy ones, much like blk-mq tags. A
+ *   context is taken by setting its bit, without any lock, and each CPU
+ *   starts looking where it last found a free one, so CPUs mostly work in
+ *   different words of the bitmap.
+ *
+ *   Only when all ctx_depth contexts are busy does an I/O allocate one,
+ *   and that is counted as ctx_allocs in debugfs stats. It should stay 0
+ *   in steady state, e.g. during a fio run.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+#include "sample_blk.h"
+
+/* Requests in flight are bounded by nr_requests per direction */
+static unsigned int ctx_depth = 2 * BLKDEV_MAX_RQ;
+module_param(ctx_depth, uint, 0444);
+MODULE_PARM_DESC(ctx_depth, "Preallocated per-I/O contexts");
+
+struct sampleblk_ctx *sampleblk_ctx_get(struct sampleblk_dev *dev, int dir,
+		unsigned int bytes)
+{
+	struct sampleblk_ctx_pool *pool = &dev->ctx_pool;
+	struct sampleblk_ctx *ctx = NULL;
+	unsigned int hint = this_cpu_read(*pool->hint);
+	unsigned int tag;
+	bool wrapped = !hint;
+
+	for (;;) {
+		tag = find_next_zero_bit(pool->map, pool->depth, hint);
+		if (tag >= pool->depth) {
+			if (wrapped)
+				break;
+			wrapped = true;
+			hint = 0;
+			continue;
+		}
+		if (!test_and_set_bit_lock(tag, pool->map)) {
+			this_cpu_write(*pool->hint, tag + 1 < pool->depth ?
+				tag + 1 : 0);
+			ctx = &pool->ctx[tag];
+			ctx->tag = tag;
+			break;
+		}
+		hint = tag + 1;
+	}
+
+	if (!ctx) {
+		ctx = kmalloc(sizeof(*ctx), GFP_ATOMIC);
+		if (!ctx)
+			return NULL;
+		ctx->tag = -1;
+		this_cpu_inc(dev->stats->ctx_allocs);
+	}
+
+	ctx->dir = dir;
+	ctx->bytes = bytes;
+	ctx->issue_ns = ktime_get_ns();
+
+	return ctx;
+}
+
+void sampleblk_ctx_put(struct sampleblk_dev *dev, struct sampleblk_ctx *ctx)
+{
+	if (ctx->tag < 0)
+		kfree(ctx);
+	else
+		clear_bit_unlock(ctx->tag, dev->ctx_pool.map);
+}
+
+/* The time from sampleblk_ctx_get to now is the service time */
+void sampleblk_ctx_complete(struct sampleblk_dev *dev,
+		struct sampleblk_ctx *ctx)
+{
+	this_cpu_add(dev->stats->service_ns[ctx->dir],
+		ktime_get_ns() - ctx->issue_ns);
+	sampleblk_ctx_put(dev, ctx);
+}
+
+int sampleblk_ctx_init(struct sampleblk_dev *dev)
+{
+	struct sampleblk_ctx_pool *pool = &dev->ctx_pool;
+	int cpu;
+
+	pool->depth = max(ctx_depth, 1U);
+	pool->ctx = kcalloc(pool->depth, sizeof(*pool->ctx), GFP_KERNEL);
+	pool->map = kcalloc(BITS_TO_LONGS(pool->depth), sizeof(long),
+		GFP_KERNEL);
+	pool->hint = alloc_percpu(unsigned int);
+	if (!pool->ctx || !pool->map || !pool->hint) {
+		sampleblk_ctx_free(dev);
+		return -ENOMEM;
+	}
+
+	/* Spread the CPUs over the bitmap */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(pool->hint, cpu) = cpu * pool->depth /
+			nr_cpu_ids;
+
+	return 0;
+}
+
+void sampleblk_ctx_free(struct sampleblk_dev *dev)
+{
+	struct sampleblk_ctx_pool *pool = &dev->ctx_pool;
+
+	free_percpu(pool->hint);
+	kfree(pool->map);
+	kfree(pool->ctx);
+	memset(pool, 0, sizeof(*pool));
+}
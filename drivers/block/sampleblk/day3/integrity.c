@@ -0,0 +1,194 @@
+/*
+ *   blk/sampleblk/integrity.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   T10 PI (DIF type 1) support. The block layer generates the protection
+ *   information on write and verifies it on read with the crc_t10dif
+ *   library, which uses PCLMULQDQ when crct10dif-pclmul is available.
+ *   The driver keeps one 8-byte tuple per sector next to the data, and
+ *   checks the guard and reference tags against the store like a real
+ *   disk would, timing that check per I/O size.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/t10-pi.h>
+#include <linux/crc-t10dif.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include "sample_blk.h"
+
+static int integrity;
+module_param(integrity, int, 0444);
+MODULE_PARM_DESC(integrity, "1: enable T10 PI type 1 with CRC guard tags");
+
+/* Never written sectors carry the escape tag, so reads don't fail */
+#define SAMPLEBLK_PI_APP_ESCAPE	cpu_to_be16(0xffff)
+
+static struct t10_pi_tuple *sampleblk_pi_tuple(struct sampleblk_dev *dev,
+		sector_t sector)
+{
+	return dev->pi + sector * sizeof(struct t10_pi_tuple);
+}
+
+static int sampleblk_pi_verify(struct sampleblk_dev *dev, sector_t sector,
+		unsigned int nr_sects)
+{
+	struct t10_pi_tuple *pi;
+	__be16 csum;
+
+	for (; nr_sects; nr_sects--, sector++) {
+		pi = sampleblk_pi_tuple(dev, sector);
+		if (pi->app_tag == SAMPLEBLK_PI_APP_ESCAPE)
+			continue;
+
+		if (be32_to_cpu(pi->ref_tag) != lower_32_bits(sector)) {
+			pr_err("sampleblk: ref tag error at sector %llu\n",
+				(unsigned long long)sector);
+			return -EILSEQ;
+		}
+
+		csum = cpu_to_be16(crc_t10dif(sampleblk_addr(dev, sector),
+			512));
+		if (pi->guard_tag != csum) {
+			pr_err("sampleblk: guard tag error at sector %llu\n",
+				(unsigned long long)sector);
+			return -EILSEQ;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Move the protection information of every bio in the request between
+ * the integrity payload pages and the tuple store.
+ */
+static void sampleblk_pi_copy(struct sampleblk_dev *dev, struct request *rq)
+{
+	struct bio_integrity_payload *bip;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	struct bio *bio;
+	void *pi, *kaddr;
+
+	__rq_for_each_bio(bio, rq) {
+		bip = bio_integrity(bio);
+		if (!bip)
+			continue;
+
+		pi = sampleblk_pi_tuple(dev, bio->bi_iter.bi_sector);
+		bip_for_each_vec(bv, bip, iter) {
+			kaddr = kmap_atomic(bv.bv_page);
+			if (rq_data_dir(rq))
+				memcpy(pi, kaddr + bv.bv_offset, bv.bv_len);
+			else
+				memcpy(kaddr + bv.bv_offset, pi, bv.bv_len);
+			kunmap_atomic(kaddr);
+			pi += bv.bv_len;
+		}
+	}
+}
+
+/*
+ * Called after the data of a write has been stored, or before the data
+ * of a read is returned. A failed write leaves the range undefined, as
+ * it would on a real disk.
+ */
+int sampleblk_integrity_rq(struct sampleblk_dev *dev, struct request *rq)
+{
+	unsigned int bytes = blk_rq_bytes(rq);
+	int idx = min_t(int, ilog2(bytes) - 9, SAMPLEBLK_PI_SIZES - 1);
+	u64 start;
+	int rv;
+
+	if (!dev->pi)
+		return 0;
+
+	if (rq_data_dir(rq))
+		sampleblk_pi_copy(dev, rq);
+
+	start = ktime_get_ns();
+	rv = sampleblk_pi_verify(dev, blk_rq_pos(rq), bytes >> 9);
+	this_cpu_add(dev->stats->pi_ns[max(idx, 0)], ktime_get_ns() - start);
+	this_cpu_inc(dev->stats->pi_ios[max(idx, 0)]);
+	if (rv) {
+		this_cpu_inc(dev->stats->pi_errors);
+		return rv;
+	}
+
+	if (!rq_data_dir(rq))
+		sampleblk_pi_copy(dev, rq);
+
+	return 0;
+}
+
+/*
+ * Data copied inside the store keeps its guard and application tags, but
+ * type 1 reference tags follow the sector, so rewrite them for dst.
+ */
+void sampleblk_integrity_copy(struct sampleblk_dev *dev, sector_t src,
+		sector_t dst, sector_t nr_sects)
+{
+	struct t10_pi_tuple *pi;
+
+	if (!dev->pi)
+		return;
+
+	for (; nr_sects; nr_sects--, src++, dst++) {
+		pi = sampleblk_pi_tuple(dev, dst);
+		*pi = *sampleblk_pi_tuple(dev, src);
+		if (pi->app_tag != SAMPLEBLK_PI_APP_ESCAPE)
+			pi->ref_tag = cpu_to_be32(lower_32_bits(dst));
+	}
+}
+
+int sampleblk_integrity_init(struct sampleblk_dev *dev)
+{
+	struct blk_integrity bi = {
+		.profile = &t10_pi_type1_crc,
+		.tuple_size = sizeof(struct t10_pi_tuple),
+		.interval_exp = 9,
+	};
+	size_t size = (dev->size >> 9) * sizeof(struct t10_pi_tuple);
+
+	if (!integrity)
+		return 0;
+
+	dev->pi = vmalloc(size);
+	if (!dev->pi)
+		return -ENOMEM;
+	memset(dev->pi, 0xff, size);
+
+	blk_integrity_register(dev->disk, &bi);
+
+	return 0;
+}
+
+void sampleblk_integrity_free(struct sampleblk_dev *dev)
+{
+	if (!dev->pi)
+		return;
+
+	blk_integrity_unregister(dev->disk);
+	vfree(dev->pi);
+	dev->pi = NULL;
+}
@@ -0,0 +1,175 @@
+/*
+ *   blk/sampleblk/memdev.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   /dev/<disk>_mem maps the backing store of a sampleblk disk, so tools
+ *   that check a disk after a test can scan it at memory bandwidth instead
+ *   of reading it through the block layer. Offset N of the mapping is
+ *   byte N of the disk, whatever the stripe layout.
+ *
+ *   Coherency rules:
+ *   - opening the device syncs the page cache of the disk, so data
+ *     written through it is in the store before it is mapped;
+ *   - closing a writable open invalidates that page cache, so block
+ *     readers see what was written through the mapping;
+ *   - there is no locking against in-flight block I/O, a mapping can see
+ *     a request half copied, just like DMA on real hardware;
+ *   - shared writable mappings are refused with integrity enabled, as
+ *     they would leave the PI tuples stale;
+ *   - changed block tracking can't see stores through a mapping, so a
+ *     shared writable mapping marks the whole disk changed when it is
+ *     created and again when it goes away.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/miscdevice.h>
+#include <linux/blkdev.h>
+#include "sample_blk.h"
+
+static struct sampleblk_dev *sampleblk_memdev_to_dev(struct file *file)
+{
+	struct miscdevice *misc = file->private_data;
+
+	return container_of(misc, struct sampleblk_dev, memdev);
+}
+
+static int sampleblk_memdev_fault(struct vm_area_struct *vma,
+		struct vm_fault *vmf)
+{
+	struct sampleblk_dev *dev = vma->vm_private_data;
+	uint64_t pos = (uint64_t)vmf->pgoff << PAGE_SHIFT;
+	struct sampleblk_stripe *stripe;
+	struct page *page;
+	size_t off, len;
+
+	if (pos >= dev->size)
+		return VM_FAULT_SIGBUS;
+
+	stripe = sampleblk_map(dev, pos, &off, &len);
+	page = vmalloc_to_page(stripe->data + off);
+	get_page(page);
+	vmf->page = page;
+
+	return 0;
+}
+
+static void sampleblk_memdev_vm_close(struct vm_area_struct *vma)
+{
+	struct sampleblk_dev *dev = vma->vm_private_data;
+
+	if ((vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_MAYWRITE))
+		sampleblk_cbt_mark(dev, 0, dev->size);
+}
+
+static const struct vm_operations_struct sampleblk_memdev_vm_ops = {
+	.fault = sampleblk_memdev_fault,
+	.close = sampleblk_memdev_vm_close,
+};
+
+static int sampleblk_memdev_mmap(struct file *file,
+		struct vm_area_struct *vma)
+{
+	struct sampleblk_dev *dev = sampleblk_memdev_to_dev(file);
+
+	/* A page must not straddle two stripes */
+	if (dev->nr_stripes > 1 && (dev->chunk_sects << 9) % PAGE_SIZE)
+		return -ENODEV;
+
+	if (dev->pi && (vma->vm_flags & VM_SHARED)) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EACCES;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	if ((vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_MAYWRITE))
+		sampleblk_cbt_mark(dev, 0, dev->size);
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_private_data = dev;
+	vma->vm_ops = &sampleblk_memdev_vm_ops;
+
+	return 0;
+}
+
+static int sampleblk_memdev_open(struct inode *inode, struct file *file)
+{
+	struct sampleblk_dev *dev = sampleblk_memdev_to_dev(file);
+	struct block_device *bdev;
+	int rv;
+
+	bdev = bdget_disk(dev->disk, 0);
+	if (!bdev)
+		return -ENODEV;
+	rv = sync_blockdev(bdev);
+	bdput(bdev);
+
+	return rv;
+}
+
+static int sampleblk_memdev_release(struct inode *inode, struct file *file)
+{
+	struct sampleblk_dev *dev = sampleblk_memdev_to_dev(file);
+	struct block_device *bdev;
+
+	if (!(file->f_mode & FMODE_WRITE))
+		return 0;
+
+	bdev = bdget_disk(dev->disk, 0);
+	if (bdev) {
+		invalidate_bdev(bdev);
+		bdput(bdev);
+	}
+
+	return 0;
+}
+
+static const struct file_operations sampleblk_memdev_fops = {
+	.owner = THIS_MODULE,
+	.open = sampleblk_memdev_open,
+	.release = sampleblk_memdev_release,
+	.mmap = sampleblk_memdev_mmap,
+	.llseek = noop_llseek,
+};
+
+int sampleblk_memdev_init(struct sampleblk_dev *dev)
+{
+	int rv;
+
+	snprintf(dev->memdev_name, sizeof(dev->memdev_name), "%s_mem",
+		dev->disk->disk_name);
+
+	dev->memdev.minor = MISC_DYNAMIC_MINOR;
+	dev->memdev.name = dev->memdev_name;
+	dev->memdev.fops = &sampleblk_memdev_fops;
+	dev->memdev.mode = 0600;
+
+	rv = misc_register(&dev->memdev);
+	if (rv)
+		dev->memdev.fops = NULL;
+
+	return rv;
+}
+
+void sampleblk_memdev_free(struct sampleblk_dev *dev)
+{
+	if (dev->memdev.fops)
+		misc_deregister(&dev->memdev);
+}
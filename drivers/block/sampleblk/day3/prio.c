@@ -0,0 +1,150 @@
+/*
+ *   blk/sampleblk/prio.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   I/O priority dispatch. sampleblk_request pulls everything the I/O
+ *   scheduler has for it into one lane per ioprio class, then serves the
+ *   lanes weighted round robin: in every round a class may dispatch up to
+ *   prio_weight[class] requests, RT first, then BE, then IDLE. So with
+ *   noop or deadline, a latency sensitive RT read no longer waits behind
+ *   every bulk write that was queued before it.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/ioprio.h>
+#include <linux/sched.h>
+#include <linux/log2.h>
+#include "sample_blk.h"
+
+static unsigned int prio_weight[SAMPLEBLK_PRIO_CLASSES] = { 8, 4, 1 };
+module_param_array(prio_weight, uint, NULL, 0644);
+MODULE_PARM_DESC(prio_weight, "Requests per round for RT,BE,IDLE");
+
+/* Lane index, requests without a class are best effort */
+static int sampleblk_prio_class(struct request *rq)
+{
+	switch (IOPRIO_PRIO_CLASS(req_get_ioprio(rq))) {
+	case IOPRIO_CLASS_RT:
+		return SAMPLEBLK_PRIO_RT;
+	case IOPRIO_CLASS_IDLE:
+		return SAMPLEBLK_PRIO_IDLE;
+	default:
+		return SAMPLEBLK_PRIO_BE;
+	}
+}
+
+void sampleblk_lanes_init(struct sampleblk_lanes *lanes)
+{
+	int i;
+
+	for (i = 0; i < SAMPLEBLK_PRIO_CLASSES; i++) {
+		INIT_LIST_HEAD(&lanes->lane[i]);
+		lanes->credit[i] = 0;
+	}
+}
+
+void sampleblk_lanes_add(struct sampleblk_lanes *lanes, struct request *rq)
+{
+	list_add_tail(&rq->queuelist, &lanes->lane[sampleblk_prio_class(rq)]);
+}
+
+/* Undo sampleblk_lanes_next, rq goes back to the head of its lane */
+void sampleblk_lanes_putback(struct sampleblk_lanes *lanes,
+		struct request *rq)
+{
+	list_add(&rq->queuelist, &lanes->lane[sampleblk_prio_class(rq)]);
+}
+
+struct request *sampleblk_lanes_next(struct sampleblk_lanes *lanes)
+{
+	struct request *rq;
+	int i, pass;
+
+	/* Second pass starts a new round, unless every lane is empty */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < SAMPLEBLK_PRIO_CLASSES; i++) {
+			if (list_empty(&lanes->lane[i]) || !lanes->credit[i])
+				continue;
+
+			rq = list_first_entry(&lanes->lane[i], struct request,
+				queuelist);
+			list_del_init(&rq->queuelist);
+			lanes->credit[i]--;
+			return rq;
+		}
+
+		for (i = 0; i < SAMPLEBLK_PRIO_CLASSES; i++)
+			lanes->credit[i] = READ_ONCE(prio_weight[i]);
+	}
+
+	/* All weights of the pending classes are 0, go by class order */
+	for (i = 0; i < SAMPLEBLK_PRIO_CLASSES; i++) {
+		if (list_empty(&lanes->lane[i]))
+			continue;
+
+		rq = list_first_entry(&lanes->lane[i], struct request,
+			queuelist);
+		list_del_init(&rq->queuelist);
+		return rq;
+	}
+
+	return NULL;
+}
+
+/*
+ * Account a request that is about to complete. The latency is from the
+ * allocation of the request to now, so it includes the time spent in
+ * the I/O scheduler and in the lanes. The block layer only takes that
+ * timestamp with CONFIG_BLK_CGROUP.
+ */
+void sampleblk_prio_account(struct sampleblk_dev *dev, struct request *rq)
+{
+	int class = sampleblk_prio_class(rq);
+	u64 start = rq_start_time_ns(rq);
+	u64 us;
+	int idx;
+
+	this_cpu_inc(dev->stats->prio_ios[class]);
+	if (!start)
+		return;
+
+	us = (sched_clock() - start) / NSEC_PER_USEC;
+	idx = us ? min_t(int, ilog2(us) + 1, SAMPLEBLK_LAT_BUCKETS - 1) : 0;
+	this_cpu_inc(dev->stats->prio_lat[class][idx]);
+}
+
+/*
+ * Give the requests still in the lanes back to the block layer. Requeued
+ * requests go to the head of the dispatch list, so walk the lanes from
+ * the back to keep their order for the next run.
+ */
+void sampleblk_lanes_requeue(struct request_queue *q,
+		struct sampleblk_lanes *lanes)
+{
+	struct request *rq, *tmp;
+	int i;
+
+	for (i = SAMPLEBLK_PRIO_CLASSES - 1; i >= 0; i--) {
+		list_for_each_entry_safe_reverse(rq, tmp, &lanes->lane[i],
+				queuelist) {
+			list_del_init(&rq->queuelist);
+			blk_requeue_request(q, rq);
+		}
+	}
+}
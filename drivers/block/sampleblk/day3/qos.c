@@ -0,0 +1,305 @@
+/*
+ *   blk/sampleblk/qos.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   Bandwidth and IOPS limits, to emulate cloud volume throttling. There
+ *   is one token bucket per limit: bytes and I/Os for reads, for writes
+ *   and for both directions together. Every limit is set at runtime in
+ *   /sys/block/<disk>/qos/, as tokens per second plus a burst size, and 0
+ *   means unlimited.
+ *
+ *   Each CPU keeps a small cache of tokens taken from the bucket, so an
+ *   I/O only takes the bucket lock when its CPU has run out, at most
+ *   about once per millisecond worth of tokens.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/device.h>
+#include <linux/ktime.h>
+#include "sample_blk.h"
+
+static void sampleblk_tb_reset(struct sampleblk_tb *tb, u64 rate, u64 burst)
+{
+	int cpu;
+
+	spin_lock_irq(&tb->lock);
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(tb->cache, cpu) = 0;
+	tb->burst = burst ? burst : rate;
+	tb->tokens = tb->burst;
+	tb->last_ns = ktime_get_ns();
+	/* Only publish the rate once the bucket is consistent */
+	smp_store_release(&tb->rate, rate);
+	spin_unlock_irq(&tb->lock);
+}
+
+/* Caller holds tb->lock */
+static void sampleblk_tb_refill(struct sampleblk_tb *tb, u64 rate)
+{
+	u64 now = ktime_get_ns();
+	u64 us = div_u64(now - tb->last_ns, NSEC_PER_USEC);
+	u64 need = tb->burst - tb->tokens;
+	u32 rem;
+	u64 secs = div_u64_rem(us, USEC_PER_SEC, &rem);
+	u64 add;
+
+	/* Idle long enough to fill up, paying off any debt on the way */
+	if (secs > div64_u64(need, rate)) {
+		tb->tokens = tb->burst;
+		tb->last_ns = now;
+		return;
+	}
+
+	/* Keep the remainder for next time rather than losing it */
+	add = rate * secs + div_u64(rate * rem, USEC_PER_SEC);
+	if (!add)
+		return;
+
+	tb->tokens = min_t(s64, tb->tokens + add, tb->burst);
+	tb->last_ns += us * NSEC_PER_USEC;
+}
+
+static bool sampleblk_tb_take(struct sampleblk_tb *tb, u64 n)
+{
+	u64 rate = smp_load_acquire(&tb->rate);
+	u64 *cache, want;
+	bool ok = true;
+
+	if (!rate)
+		return true;
+
+	cache = get_cpu_ptr(tb->cache);
+	if (*cache < n) {
+		/* Top up this CPU with the shortfall plus 1ms of tokens */
+		want = n - *cache + div_u64(rate, MSEC_PER_SEC);
+
+		spin_lock(&tb->lock);
+		sampleblk_tb_refill(tb, rate);
+		/*
+		 * The bucket never holds more than burst tokens, so an I/O
+		 * larger than that goes once the bucket is full, and leaves
+		 * it in debt for the rest.
+		 */
+		if ((s64)*cache + tb->tokens >= (s64)min(n, tb->burst)) {
+			want = max_t(s64, min_t(s64, want, tb->tokens),
+				n - *cache);
+			tb->tokens -= want;
+			*cache += want;
+		} else {
+			ok = false;
+		}
+		spin_unlock(&tb->lock);
+	}
+	if (ok)
+		*cache -= n;
+	put_cpu_ptr(tb->cache);
+
+	return ok;
+}
+
+static void sampleblk_tb_give_back(struct sampleblk_tb *tb, u64 n)
+{
+	if (smp_load_acquire(&tb->rate))
+		this_cpu_add(*tb->cache, n);
+}
+
+/*
+ * Take the tokens an I/O needs from every bucket that applies to it, or
+ * none at all. The time between the first I/O refused in a direction and
+ * the next one let through is accounted as throttled time.
+ */
+bool sampleblk_qos_allow(struct sampleblk_dev *dev, int dir,
+		unsigned int bytes)
+{
+	struct sampleblk_qos *qos = &dev->qos;
+	int tbs[] = {
+		dir ? SAMPLEBLK_QOS_WRITE_BPS : SAMPLEBLK_QOS_READ_BPS,
+		dir ? SAMPLEBLK_QOS_WRITE_IOPS : SAMPLEBLK_QOS_READ_IOPS,
+		SAMPLEBLK_QOS_BPS,
+		SAMPLEBLK_QOS_IOPS,
+	};
+	u64 now, start;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tbs); i++) {
+		u64 n = (tbs[i] & 1) ? 1 : bytes;
+
+		if (!sampleblk_tb_take(&qos->tb[tbs[i]], n))
+			break;
+	}
+
+	if (i < ARRAY_SIZE(tbs)) {
+		while (--i >= 0)
+			sampleblk_tb_give_back(&qos->tb[tbs[i]],
+				(tbs[i] & 1) ? 1 : bytes);
+		if (!atomic64_cmpxchg(&qos->throttle_start[dir], 0,
+				ktime_get_ns()))
+			this_cpu_inc(dev->stats->throttle_events[dir]);
+		return false;
+	}
+
+	if (atomic64_read(&qos->throttle_start[dir])) {
+		now = ktime_get_ns();
+		start = atomic64_xchg(&qos->throttle_start[dir], 0);
+		if (start)
+			this_cpu_add(dev->stats->throttled_ns[dir],
+				now - start);
+	}
+
+	return true;
+}
+
+void sampleblk_qos_set(struct sampleblk_dev *dev, int tb, u64 rate,
+		u64 burst)
+{
+	sampleblk_tb_reset(&dev->qos.tb[tb], rate, burst);
+}
+
+struct sampleblk_qos_attr {
+	struct device_attribute attr;
+	int tb;
+	bool burst;
+};
+
+static ssize_t sampleblk_qos_show(struct device *d,
+		struct device_attribute *attr, char *page)
+{
+	struct sampleblk_dev *dev = dev_to_disk(d)->private_data;
+	struct sampleblk_qos_attr *qa = container_of(attr,
+		struct sampleblk_qos_attr, attr);
+	struct sampleblk_tb *tb = &dev->qos.tb[qa->tb];
+
+	return sprintf(page, "%llu\n", qa->burst ? tb->burst : tb->rate);
+}
+
+static ssize_t sampleblk_qos_store(struct device *d,
+		struct device_attribute *attr, const char *page, size_t count)
+{
+	struct sampleblk_dev *dev = dev_to_disk(d)->private_data;
+	struct sampleblk_qos_attr *qa = container_of(attr,
+		struct sampleblk_qos_attr, attr);
+	struct sampleblk_tb *tb = &dev->qos.tb[qa->tb];
+	u64 val;
+	int rv;
+
+	rv = kstrtoull(page, 0, &val);
+	if (rv)
+		return rv;
+
+	if (qa->burst)
+		sampleblk_tb_reset(tb, tb->rate, val);
+	else
+		sampleblk_tb_reset(tb, val, tb->burst == tb->rate ? 0 :
+			tb->burst);
+
+	/* Let I/O held back under the old limit go */
+	sampleblk_run_queue(dev);
+
+	return count;
+}
+
+#define SAMPLEBLK_QOS_ATTR(_name, _tb, _burst)				\
+static struct sampleblk_qos_attr sampleblk_qos_attr_##_name = {	\
+	.attr = __ATTR(_name, 0644, sampleblk_qos_show,			\
+		sampleblk_qos_store),					\
+	.tb = _tb,							\
+	.burst = _burst,						\
+}
+
+SAMPLEBLK_QOS_ATTR(read_bps, SAMPLEBLK_QOS_READ_BPS, false);
+SAMPLEBLK_QOS_ATTR(read_bps_burst, SAMPLEBLK_QOS_READ_BPS, true);
+SAMPLEBLK_QOS_ATTR(read_iops, SAMPLEBLK_QOS_READ_IOPS, false);
+SAMPLEBLK_QOS_ATTR(read_iops_burst, SAMPLEBLK_QOS_READ_IOPS, true);
+SAMPLEBLK_QOS_ATTR(write_bps, SAMPLEBLK_QOS_WRITE_BPS, false);
+SAMPLEBLK_QOS_ATTR(write_bps_burst, SAMPLEBLK_QOS_WRITE_BPS, true);
+SAMPLEBLK_QOS_ATTR(write_iops, SAMPLEBLK_QOS_WRITE_IOPS, false);
+SAMPLEBLK_QOS_ATTR(write_iops_burst, SAMPLEBLK_QOS_WRITE_IOPS, true);
+SAMPLEBLK_QOS_ATTR(bps, SAMPLEBLK_QOS_BPS, false);
+SAMPLEBLK_QOS_ATTR(bps_burst, SAMPLEBLK_QOS_BPS, true);
+SAMPLEBLK_QOS_ATTR(iops, SAMPLEBLK_QOS_IOPS, false);
+SAMPLEBLK_QOS_ATTR(iops_burst, SAMPLEBLK_QOS_IOPS, true);
+
+static struct attribute *sampleblk_qos_attrs[] = {
+	&sampleblk_qos_attr_read_bps.attr.attr,
+	&sampleblk_qos_attr_read_bps_burst.attr.attr,
+	&sampleblk_qos_attr_read_iops.attr.attr,
+	&sampleblk_qos_attr_read_iops_burst.attr.attr,
+	&sampleblk_qos_attr_write_bps.attr.attr,
+	&sampleblk_qos_attr_write_bps_burst.attr.attr,
+	&sampleblk_qos_attr_write_iops.attr.attr,
+	&sampleblk_qos_attr_write_iops_burst.attr.attr,
+	&sampleblk_qos_attr_bps.attr.attr,
+	&sampleblk_qos_attr_bps_burst.attr.attr,
+	&sampleblk_qos_attr_iops.attr.attr,
+	&sampleblk_qos_attr_iops_burst.attr.attr,
+	NULL,
+};
+
+static struct attribute_group sampleblk_qos_group = {
+	.name = "qos",
+	.attrs = sampleblk_qos_attrs,
+};
+
+int sampleblk_qos_init(struct sampleblk_dev *dev)
+{
+	struct sampleblk_qos *qos = &dev->qos;
+	int i;
+
+	for (i = 0; i < SAMPLEBLK_QOS_NR; i++) {
+		spin_lock_init(&qos->tb[i].lock);
+		qos->tb[i].cache = alloc_percpu(u64);
+		if (!qos->tb[i].cache) {
+			sampleblk_qos_free(dev);
+			return -ENOMEM;
+		}
+	}
+	atomic64_set(&qos->throttle_start[READ], 0);
+	atomic64_set(&qos->throttle_start[WRITE], 0);
+
+	return 0;
+}
+
+void sampleblk_qos_free(struct sampleblk_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < SAMPLEBLK_QOS_NR; i++) {
+		free_percpu(dev->qos.tb[i].cache);
+		dev->qos.tb[i].cache = NULL;
+	}
+}
+
+int sampleblk_qos_sysfs_init(struct sampleblk_dev *dev)
+{
+	int rv;
+
+	rv = sysfs_create_group(&disk_to_dev(dev->disk)->kobj,
+		&sampleblk_qos_group);
+	dev->qos.sysfs = !rv;
+
+	return rv;
+}
+
+void sampleblk_qos_sysfs_free(struct sampleblk_dev *dev)
+{
+	if (dev->qos.sysfs)
+		sysfs_remove_group(&disk_to_dev(dev->disk)->kobj,
+		&sampleblk_qos_group);
+}
@@ -0,0 +1,998 @@
+/*
+ *   blk/sampleblk/sample_blk.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   Primitive example to show how to create a Linux block driver
+ *
+ *   Unlike day1 and day2, which build on the RHEL7 3.10 kernel the labs
+ *   were run on, day3 is written for a 4.6 kernel: make_request returns
+ *   blk_qc_t, bios complete with bi_error, and the request_fn queue and
+ *   REQ_TYPE_FS are still there. Any kernel from 4.4 to 4.12 will do.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/tracepoint.h>
+#include <linux/workqueue.h>
+#include <linux/nodemask.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include "sample_blk.h"
+#include "sampleblk_ioctl.h"
+
+static int sampleblk_major;
+#define SAMPLEBLK_MINOR	1
+static int sampleblk_sect_size = 512;
+static int sampleblk_nsects = 10 * 1024;
+
+/*
+ * Request shaping limits. Zero keeps the block layer default, which is
+ * what day1 runs with. Setting them large (e.g. max_sectors=4294967295
+ * max_segments=65535 max_segment_size=4294967295) is close to what day2
+ * got from blk_set_stacking_limits.
+ */
+static unsigned int max_sectors;
+module_param(max_sectors, uint, 0444);
+MODULE_PARM_DESC(max_sectors, "Max sectors per request, 0 for default");
+
+static unsigned int max_segments;
+module_param(max_segments, uint, 0444);
+MODULE_PARM_DESC(max_segments, "Max segments per request, 0 for default");
+
+static unsigned int max_segment_size;
+module_param(max_segment_size, uint, 0444);
+MODULE_PARM_DESC(max_segment_size, "Max bytes per segment, 0 for default");
+
+/* Same meaning as /sys/block/<dev>/queue/nomerges */
+static int nomerges;
+module_param(nomerges, int, 0444);
+MODULE_PARM_DESC(nomerges, "0: all merges, 1: one-hit merges only, 2: none");
+
+/*
+ * Striped (RAID-0) layout. Each stripe has its own store allocated on
+ * its own NUMA node, and a request spanning several stripes is copied by
+ * one worker per stripe on that node, so large I/Os use the memory
+ * bandwidth of all nodes instead of one.
+ */
+static int stripes = 1;
+module_param(stripes, int, 0444);
+MODULE_PARM_DESC(stripes, "Number of stripes, 1 for a flat store");
+
+static unsigned int chunk_sectors = 128;
+module_param(chunk_sectors, uint, 0444);
+MODULE_PARM_DESC(chunk_sectors, "Stripe chunk size in sectors");
+
+/* Like null_blk, 0 is the request_fn queue, 1 bypasses the I/O scheduler */
+#define SAMPLEBLK_Q_RQ	0
+#define SAMPLEBLK_Q_BIO	1
+
+static int queue_mode = SAMPLEBLK_Q_RQ;
+module_param(queue_mode, int, 0444);
+MODULE_PARM_DESC(queue_mode, "0: request based, 1: bio based");
+
+struct sampleblk_stripe_work {
+	struct work_struct work;
+	struct sampleblk_dev *dev;
+	struct bio *bio;
+	struct sampleblk_stripe *stripe;
+};
+
+static struct workqueue_struct *sampleblk_wq;
+
+struct sampleblk_dev *sampleblk_dev = NULL;
+
+static struct dentry *sampleblk_debugfs_root;
+
+/*
+ * Do an I/O operation for each segment, piece by piece as it crosses
+ * chunk boundaries. Only pieces on stripe "only" are copied, unless it
+ * is NULL. A flat store has a single stripe, so its lock would be one
+ * global lock on every I/O; it is skipped there, like day1 had none.
+ */
+int sampleblk_handle_io(struct sampleblk_dev *sampleblk_dev,
+		uint64_t pos, ssize_t size, void *buffer, int write,
+		struct sampleblk_stripe *only)
+{
+	bool locked = sampleblk_dev->nr_stripes > 1;
+	struct sampleblk_stripe *stripe;
+	size_t off, len;
+
+	while (size > 0) {
+		stripe = sampleblk_map(sampleblk_dev, pos, &off, &len);
+		len = min_t(size_t, len, size);
+
+		if (!only || stripe == only) {
+			if (locked)
+				spin_lock(&stripe->lock);
+			if (write)
+				memcpy(stripe->data + off, buffer, len);
+			else
+				memcpy(buffer, stripe->data + off, len);
+			if (locked)
+				spin_unlock(&stripe->lock);
+		}
+
+		pos += len;
+		buffer += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+/*
+ * Copy a chain of bios linked by bi_next, which is rq->bio for a request
+ * or just one bio in bio mode.
+ */
+static int sampleblk_copy_bios(struct sampleblk_dev *sampleblk_dev,
+		struct bio *bio, struct sampleblk_stripe *only)
+{
+	uint64_t pos;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	void *kaddr = NULL;
+	int rv = 0;
+
+	for (; bio; bio = bio->bi_next) {
+		pos = bio->bi_iter.bi_sector * sampleblk_sect_size;
+
+		bio_for_each_segment(bvec, bio, iter) {
+			kaddr = kmap_atomic(bvec.bv_page);
+
+			rv = sampleblk_handle_io(sampleblk_dev, pos,
+				bvec.bv_len, kaddr + bvec.bv_offset,
+				bio_data_dir(bio), only);
+
+			kunmap_atomic(kaddr);
+			if (rv < 0)
+				return rv;
+
+			pos += bvec.bv_len;
+		}
+	}
+
+	return rv;
+}
+
+static void sampleblk_stripe_workfn(struct work_struct *work)
+{
+	struct sampleblk_stripe_work *sw = container_of(work,
+		struct sampleblk_stripe_work, work);
+
+	sampleblk_copy_bios(sw->dev, sw->bio, sw->stripe);
+}
+
+/*
+ * Hand every stripe but the first one touched by the I/O to a worker on
+ * the stripe's node, copy the first one here and wait for the rest.
+ */
+int sampleblk_copy_striped(struct sampleblk_dev *sampleblk_dev,
+		struct bio *bio, sector_t sector, unsigned int nr_sects)
+{
+	struct sampleblk_stripe_work works[SAMPLEBLK_MAX_STRIPES];
+	sector_t first = sector;
+	sector_t last = first + nr_sects - 1;
+	int nr, i, idx, cpu;
+
+	if (!nr_sects)
+		return 0;
+
+	sector_div(first, sampleblk_dev->chunk_sects);
+	sector_div(last, sampleblk_dev->chunk_sects);
+	nr = min_t(sector_t, last - first + 1, sampleblk_dev->nr_stripes);
+	if (nr == 1)
+		return sampleblk_copy_bios(sampleblk_dev, bio, NULL);
+
+	idx = sector_div(first, sampleblk_dev->nr_stripes);
+	for (i = 1; i < nr; i++) {
+		struct sampleblk_stripe_work *sw = &works[i];
+
+		sw->dev = sampleblk_dev;
+		sw->bio = bio;
+		sw->stripe = &sampleblk_dev->stripes[(idx + i) %
+			sampleblk_dev->nr_stripes];
+		INIT_WORK_ONSTACK(&sw->work, sampleblk_stripe_workfn);
+
+		/* On an unbound workqueue, the cpu only selects the node */
+		cpu = cpumask_any_and(cpumask_of_node(sw->stripe->node),
+			cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = WORK_CPU_UNBOUND;
+		queue_work_on(cpu, sampleblk_wq, &sw->work);
+	}
+	this_cpu_add(sampleblk_dev->stats->stripe_works, nr - 1);
+
+	sampleblk_copy_bios(sampleblk_dev, bio, &sampleblk_dev->stripes[idx]);
+
+	for (i = 1; i < nr; i++) {
+		flush_work(&works[i].work);
+		destroy_work_on_stack(&works[i].work);
+	}
+
+	return 0;
+}
+
+static void sampleblk_free_stripes(struct sampleblk_dev *sampleblk_dev)
+{
+	int i;
+
+	for (i = 0; i < sampleblk_dev->nr_stripes; i++)
+		vfree(sampleblk_dev->stripes[i].data);
+}
+
+static int sampleblk_alloc_stripes(struct sampleblk_dev *sampleblk_dev)
+{
+	struct sampleblk_stripe *stripe;
+	sector_t nsects = sampleblk_nsects;
+	size_t stripe_size;
+	int node = first_online_node;
+	int i;
+
+	if (stripes < 1 || stripes > SAMPLEBLK_MAX_STRIPES || !chunk_sectors)
+		return -EINVAL;
+
+	sampleblk_dev->nr_stripes = stripes;
+	if (stripes == 1) {
+		sampleblk_dev->chunk_sects = nsects;
+	} else {
+		/* Capacity is rounded down to a whole number of stripe rows */
+		sampleblk_dev->chunk_sects = chunk_sectors;
+		sector_div(nsects, chunk_sectors * stripes);
+		nsects *= chunk_sectors * stripes;
+		if (!nsects)
+			return -EINVAL;
+	}
+	sampleblk_dev->size = nsects * sampleblk_sect_size;
+	stripe_size = sampleblk_dev->size / stripes;
+
+	for (i = 0; i < stripes; i++) {
+		stripe = &sampleblk_dev->stripes[i];
+		stripe->node = node;
+		spin_lock_init(&stripe->lock);
+		stripe->data = vmalloc_node(stripe_size, node);
+		if (!stripe->data) {
+			sampleblk_free_stripes(sampleblk_dev);
+			return -ENOMEM;
+		}
+
+		node = next_online_node(node);
+		if (node == MAX_NUMNODES)
+			node = first_online_node;
+	}
+
+	return 0;
+}
+
+static void sampleblk_request(struct request_queue *q)
+{
+	struct sampleblk_lanes lanes;
+	struct sampleblk_ctx *ctx;
+	struct request *rq = NULL;
+	int rv = 0;
+	uint64_t pos = 0;
+	ssize_t size = 0;
+	struct bio *bio;
+
+	sampleblk_lanes_init(&lanes);
+	for (;;) {
+		/* Pull in new arrivals so they can overtake queued ones */
+		while ((rq = blk_fetch_request(q)) != NULL)
+			sampleblk_lanes_add(&lanes, rq);
+
+		rq = sampleblk_lanes_next(&lanes);
+		if (!rq)
+			break;
+
+		/*
+		 * Without a context or over the QoS limits, hand everything
+		 * back and retry later.
+		 */
+		ctx = NULL;
+		if (rq->cmd_type == REQ_TYPE_FS) {
+			ctx = sampleblk_ctx_get(sampleblk_dev, rq_data_dir(rq),
+				blk_rq_bytes(rq));
+			if (!ctx || !sampleblk_qos_allow(sampleblk_dev,
+					rq_data_dir(rq), blk_rq_bytes(rq))) {
+				if (ctx)
+					sampleblk_ctx_put(sampleblk_dev, ctx);
+				sampleblk_lanes_putback(&lanes, rq);
+				sampleblk_lanes_requeue(q, &lanes);
+				blk_delay_queue(q, 1);
+				break;
+			}
+		}
+
+		spin_unlock_irq(q->queue_lock);
+
+		if (rq->cmd_type != REQ_TYPE_FS) {
+			rv = -EIO;
+			goto skip;
+		}
+
+		BUG_ON(sampleblk_dev != rq->rq_disk->private_data);
+
+		this_cpu_inc(sampleblk_dev->stats->requests);
+		__rq_for_each_bio(bio, rq)
+			this_cpu_inc(sampleblk_dev->stats->bios);
+
+		pos = blk_rq_pos(rq) * sampleblk_sect_size;
+		size = blk_rq_bytes(rq);
+		if (sampleblk_beyond_end(sampleblk_dev, pos, size)) {
+			pr_crit("sampleblk: Beyond-end write (%llu %zx)\n",
+				pos, size);
+			rv = -EIO;
+			goto skip;
+		}
+
+		rv = sampleblk_copy_striped(sampleblk_dev, rq->bio,
+			blk_rq_pos(rq), blk_rq_sectors(rq));
+		if (rv < 0)
+			goto skip;
+		if (rq_data_dir(rq))
+			sampleblk_cbt_mark(sampleblk_dev, pos, size);
+
+		if (blk_integrity_rq(rq))
+			rv = sampleblk_integrity_rq(sampleblk_dev, rq);
+skip:
+
+		if (ctx)
+			sampleblk_ctx_complete(sampleblk_dev, ctx);
+		sampleblk_prio_account(sampleblk_dev, rq);
+		blk_end_request_all(rq, rv);
+
+		spin_lock_irq(q->queue_lock);
+	}
+}
+
+static void sampleblk_bio_io(struct sampleblk_dev *sampleblk_dev,
+		struct bio *bio)
+{
+	uint64_t pos = bio->bi_iter.bi_sector * sampleblk_sect_size;
+	struct sampleblk_ctx *ctx;
+	int rv;
+
+	ctx = sampleblk_ctx_get(sampleblk_dev, bio_data_dir(bio),
+		bio->bi_iter.bi_size);
+	if (!ctx) {
+		rv = -ENOMEM;
+		goto out;
+	}
+
+	rv = sampleblk_copy_striped(sampleblk_dev, bio,
+		bio->bi_iter.bi_sector, bio_sectors(bio));
+	if (!rv && bio_data_dir(bio))
+		sampleblk_cbt_mark(sampleblk_dev, pos, bio->bi_iter.bi_size);
+	sampleblk_ctx_complete(sampleblk_dev, ctx);
+out:
+	bio->bi_error = rv;
+	bio_endio(bio);
+}
+
+/*
+ * Issue the bios held back by the QoS limits in arrival order, and come
+ * back a jiffy later, like blk_delay_queue, when the limits still don't
+ * let the next one through.
+ */
+static void sampleblk_throttle_workfn(struct work_struct *work)
+{
+	struct sampleblk_dev *sampleblk_dev = container_of(
+		to_delayed_work(work), struct sampleblk_dev, throttle_work);
+	struct bio *bio;
+
+	spin_lock_irq(&sampleblk_dev->lock);
+	while ((bio = bio_list_peek(&sampleblk_dev->throttled)) != NULL) {
+		if (!sampleblk_qos_allow(sampleblk_dev, bio_data_dir(bio),
+				bio->bi_iter.bi_size)) {
+			queue_delayed_work(sampleblk_wq,
+				&sampleblk_dev->throttle_work, 1);
+			break;
+		}
+		bio_list_pop(&sampleblk_dev->throttled);
+		spin_unlock_irq(&sampleblk_dev->lock);
+
+		sampleblk_bio_io(sampleblk_dev, bio);
+
+		spin_lock_irq(&sampleblk_dev->lock);
+	}
+	spin_unlock_irq(&sampleblk_dev->lock);
+}
+
+/*
+ * Bio mode copies the bio in the submitter's context without the queue
+ * lock or the I/O scheduler. Splits, merges and the queue limits don't
+ * apply in this mode. A bio over the QoS limits, or behind others that
+ * are, is left to the throttle work rather than put the submitter to
+ * sleep. The unlocked check of the list only lets a bio overtake one
+ * that is being queued at the same time.
+ *
+ * The submitter can still sleep: a bio over several stripes waits in
+ * flush_work for the other stripes' workers. REQ_NOWAIT, which would
+ * have to fail such a bio with EAGAIN instead, is not in this kernel.
+ */
+static blk_qc_t sampleblk_make_request(struct request_queue *q,
+		struct bio *bio)
+{
+	struct sampleblk_dev *sampleblk_dev = q->queuedata;
+	uint64_t pos = bio->bi_iter.bi_sector * sampleblk_sect_size;
+	unsigned long flags;
+
+	this_cpu_inc(sampleblk_dev->stats->bios);
+
+	if (sampleblk_beyond_end(sampleblk_dev, pos, bio->bi_iter.bi_size)) {
+		pr_crit("sampleblk: Beyond-end bio (%llu %x)\n",
+			pos, bio->bi_iter.bi_size);
+		bio->bi_error = -EIO;
+		bio_endio(bio);
+		return BLK_QC_T_NONE;
+	}
+
+	if (bio_list_empty(&sampleblk_dev->throttled) &&
+	    sampleblk_qos_allow(sampleblk_dev, bio_data_dir(bio),
+			bio->bi_iter.bi_size)) {
+		sampleblk_bio_io(sampleblk_dev, bio);
+		return BLK_QC_T_NONE;
+	}
+
+	spin_lock_irqsave(&sampleblk_dev->lock, flags);
+	bio_list_add(&sampleblk_dev->throttled, bio);
+	spin_unlock_irqrestore(&sampleblk_dev->lock, flags);
+	queue_delayed_work(sampleblk_wq, &sampleblk_dev->throttle_work, 1);
+
+	return BLK_QC_T_NONE;
+}
+
+/* Retry the I/O held back by the QoS limits, e.g. after they changed */
+void sampleblk_run_queue(struct sampleblk_dev *sampleblk_dev)
+{
+	if (queue_mode != SAMPLEBLK_Q_BIO)
+		blk_run_queue(sampleblk_dev->queue);
+	else
+		mod_delayed_work(sampleblk_wq, &sampleblk_dev->throttle_work,
+			0);
+}
+
+static struct request_queue *sampleblk_alloc_queue(
+		struct sampleblk_dev *sampleblk_dev)
+{
+	struct request_queue *q;
+
+	if (queue_mode != SAMPLEBLK_Q_BIO)
+		return blk_init_queue(sampleblk_request, &sampleblk_dev->lock);
+
+	q = blk_alloc_queue(GFP_KERNEL);
+	if (!q)
+		return NULL;
+
+	blk_queue_make_request(q, sampleblk_make_request);
+
+	return q;
+}
+
+/*
+ * Splits and merges happen in the block layer before the request reaches
+ * sampleblk_request, so count them from the same block tracepoints that
+ * labs/lab2 recorded with perf, filtered to our own queue.
+ */
+static void sampleblk_probe_split(void *data, struct request_queue *q,
+		struct bio *bio, unsigned int new_sector)
+{
+	struct sampleblk_dev *dev = data;
+
+	if (q == dev->queue)
+		this_cpu_inc(dev->stats->splits);
+}
+
+static void sampleblk_probe_backmerge(void *data, struct request_queue *q,
+		struct request *rq, struct bio *bio)
+{
+	struct sampleblk_dev *dev = data;
+
+	if (q == dev->queue)
+		this_cpu_inc(dev->stats->back_merges);
+}
+
+static void sampleblk_probe_frontmerge(void *data, struct request_queue *q,
+		struct request *rq, struct bio *bio)
+{
+	struct sampleblk_dev *dev = data;
+
+	if (q == dev->queue)
+		this_cpu_inc(dev->stats->front_merges);
+}
+
+static struct sampleblk_tp {
+	const char *name;
+	void *probe;
+	struct tracepoint *tp;
+} sampleblk_tps[] = {
+	{ "block_split", sampleblk_probe_split },
+	{ "block_bio_backmerge", sampleblk_probe_backmerge },
+	{ "block_bio_frontmerge", sampleblk_probe_frontmerge },
+};
+
+static void sampleblk_lookup_tp(struct tracepoint *tp, void *priv)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sampleblk_tps); i++)
+		if (!strcmp(tp->name, sampleblk_tps[i].name))
+			sampleblk_tps[i].tp = tp;
+}
+
+static void sampleblk_register_tps(struct sampleblk_dev *dev)
+{
+	int i;
+
+	/* The block tracepoints are not exported, look them up by name */
+	for_each_kernel_tracepoint(sampleblk_lookup_tp, NULL);
+
+	for (i = 0; i < ARRAY_SIZE(sampleblk_tps); i++) {
+		struct sampleblk_tp *t = &sampleblk_tps[i];
+
+		if (t->tp && tracepoint_probe_register(t->tp, t->probe, dev))
+			t->tp = NULL;
+		if (!t->tp)
+			pr_warn("sampleblk: %s will not be counted\n", t->name);
+	}
+}
+
+static void sampleblk_unregister_tps(struct sampleblk_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sampleblk_tps); i++) {
+		struct sampleblk_tp *t = &sampleblk_tps[i];
+
+		if (t->tp)
+			tracepoint_probe_unregister(t->tp, t->probe, dev);
+		t->tp = NULL;
+	}
+	tracepoint_synchronize_unregister();
+}
+
+static void sampleblk_set_limits(struct request_queue *q)
+{
+	if (max_sectors) {
+		blk_queue_max_hw_sectors(q, max_sectors);
+		/* Don't let BLK_DEF_MAX_SECTORS cap the soft limit */
+		q->limits.max_sectors = q->limits.max_hw_sectors;
+	}
+	if (max_segments)
+		blk_queue_max_segments(q, min_t(unsigned int, max_segments,
+			USHRT_MAX));
+	if (max_segment_size)
+		blk_queue_max_segment_size(q, max_segment_size);
+
+	if (nomerges == 2)
+		queue_flag_set_unlocked(QUEUE_FLAG_NOMERGES, q);
+	else if (nomerges == 1)
+		queue_flag_set_unlocked(QUEUE_FLAG_NOXMERGES, q);
+}
+
+static int sampleblk_stats_show(struct seq_file *m, void *v)
+{
+	struct sampleblk_dev *dev = m->private;
+	struct sampleblk_stats sum;
+	static const char * const prio_names[] = { "rt", "be", "idle" };
+	u64 *dst = (u64 *)&sum;
+	int cpu, i, j;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		u64 *src = (u64 *)per_cpu_ptr(dev->stats, cpu);
+
+		for (i = 0; i < sizeof(sum) / sizeof(u64); i++)
+			dst[i] += src[i];
+	}
+
+	seq_printf(m, "requests %llu\n", sum.requests);
+	seq_printf(m, "bios %llu\n", sum.bios);
+	seq_printf(m, "splits %llu\n", sum.splits);
+	seq_printf(m, "back_merges %llu\n", sum.back_merges);
+	seq_printf(m, "front_merges %llu\n", sum.front_merges);
+	seq_printf(m, "stripe_works %llu\n", sum.stripe_works);
+	seq_printf(m, "copy_bytes %llu\n", sum.copy_bytes);
+	seq_printf(m, "copy_ns %llu\n", sum.copy_ns);
+	seq_printf(m, "read_throttle_events %llu\n", sum.throttle_events[READ]);
+	seq_printf(m, "read_throttled_ns %llu\n", sum.throttled_ns[READ]);
+	seq_printf(m, "write_throttle_events %llu\n",
+		sum.throttle_events[WRITE]);
+	seq_printf(m, "write_throttled_ns %llu\n", sum.throttled_ns[WRITE]);
+	seq_printf(m, "read_service_ns %llu\n", sum.service_ns[READ]);
+	seq_printf(m, "write_service_ns %llu\n", sum.service_ns[WRITE]);
+	seq_printf(m, "ctx_allocs %llu\n", sum.ctx_allocs);
+
+	for (i = 0; i < SAMPLEBLK_PRIO_CLASSES; i++) {
+		seq_printf(m, "prio_%s_ios %llu\n", prio_names[i],
+			sum.prio_ios[i]);
+		for (j = 0; j < SAMPLEBLK_LAT_BUCKETS - 1; j++)
+			seq_printf(m, "prio_%s_lat_lt_%luus %llu\n",
+				prio_names[i], 1UL << j, sum.prio_lat[i][j]);
+		/* The last bucket also holds everything slower */
+		seq_printf(m, "prio_%s_lat_ge_%luus %llu\n", prio_names[i],
+			1UL << (j - 1), sum.prio_lat[i][j]);
+	}
+
+	if (!dev->pi)
+		return 0;
+
+	seq_printf(m, "pi_errors %llu\n", sum.pi_errors);
+	for (i = 0; i < SAMPLEBLK_PI_SIZES; i++) {
+		seq_printf(m, "pi_verify_ios_%u %llu\n", 512 << i,
+			sum.pi_ios[i]);
+		seq_printf(m, "pi_verify_ns_%u %llu\n", 512 << i,
+			sum.pi_ns[i]);
+	}
+
+	return 0;
+}
+
+static int sampleblk_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sampleblk_stats_show, inode->i_private);
+}
+
+static const struct file_operations sampleblk_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = sampleblk_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void sampleblk_debugfs_init(struct sampleblk_dev *dev)
+{
+	if (!sampleblk_debugfs_root)
+		return;
+
+	dev->debugfs_dir = debugfs_create_dir(dev->disk->disk_name,
+		sampleblk_debugfs_root);
+	if (!dev->debugfs_dir)
+		return;
+
+	debugfs_create_file("stats", 0444, dev->debugfs_dir, dev,
+		&sampleblk_stats_fops);
+}
+
+/* Bounds how long the stripe locks are held and preemption is off */
+#define SAMPLEBLK_COPY_MAX	(1024 * 1024)
+
+static void sampleblk_copy_store(struct sampleblk_dev *sampleblk_dev,
+		uint64_t src, uint64_t dst, uint64_t len)
+{
+	struct sampleblk_stripe *s, *d;
+	size_t soff, slen, doff, dlen, n;
+
+	while (len) {
+		s = sampleblk_map(sampleblk_dev, src, &soff, &slen);
+		d = sampleblk_map(sampleblk_dev, dst, &doff, &dlen);
+		n = min_t(uint64_t, len, SAMPLEBLK_COPY_MAX);
+		n = min3(n, slen, dlen);
+
+		/* Take the two stripe locks in address order */
+		if (s == d) {
+			spin_lock(&s->lock);
+		} else {
+			spin_lock(&min(s, d)->lock);
+			spin_lock_nested(&max(s, d)->lock, SINGLE_DEPTH_NESTING);
+		}
+
+		memcpy(d->data + doff, s->data + soff, n);
+
+		if (s != d)
+			spin_unlock(&d->lock);
+		spin_unlock(&s->lock);
+
+		src += n;
+		dst += n;
+		len -= n;
+		cond_resched();
+	}
+}
+
+/* Write back both ranges of a copy in a page cache, off bytes into it */
+static int sampleblk_copy_sync(struct address_space *mapping, uint64_t off,
+		struct sampleblk_copy_range *r)
+{
+	int rv;
+
+	rv = filemap_write_and_wait_range(mapping, off + r->src,
+		off + r->src + r->len - 1);
+	if (!rv)
+		rv = filemap_write_and_wait_range(mapping, off + r->dst,
+			off + r->dst + r->len - 1);
+
+	return rv;
+}
+
+/*
+ * Duplicate one range of the disk into another with a single memcpy in
+ * the store, instead of reading it out to user space and writing it
+ * back like dd does. The copy bypasses the page cache, so it is synced
+ * before and dropped after, both for bdev and, on a partition, for the
+ * whole disk that also caches those sectors.
+ */
+static int sampleblk_ioctl_copy(struct block_device *bdev,
+		struct sampleblk_copy_range __user *argp)
+{
+	struct sampleblk_dev *sampleblk_dev = bdev->bd_disk->private_data;
+	struct address_space *mapping = bdev->bd_inode->i_mapping;
+	struct address_space *whole = NULL;
+	uint64_t start = (uint64_t)get_start_sect(bdev) << 9;
+	uint64_t size = i_size_read(bdev->bd_inode);
+	struct sampleblk_copy_range r;
+	u64 t;
+	int rv;
+
+	if (copy_from_user(&r, argp, sizeof(r)))
+		return -EFAULT;
+
+	if ((r.src | r.dst | r.len) & 511)
+		return -EINVAL;
+	if (!r.len)
+		return 0;
+	if (r.src >= size || r.len > size - r.src ||
+	    r.dst >= size || r.len > size - r.dst)
+		return -EINVAL;
+	if (r.src < r.dst + r.len && r.dst < r.src + r.len)
+		return -EINVAL;
+
+	if (bdev != bdev->bd_contains)
+		whole = bdev->bd_contains->bd_inode->i_mapping;
+
+	rv = sampleblk_copy_sync(mapping, 0, &r);
+	if (!rv && whole)
+		rv = sampleblk_copy_sync(whole, start, &r);
+	if (rv)
+		return rv;
+
+	t = ktime_get_ns();
+	sampleblk_copy_store(sampleblk_dev, start + r.src, start + r.dst,
+		r.len);
+	sampleblk_integrity_copy(sampleblk_dev, (start + r.src) >> 9,
+		(start + r.dst) >> 9, r.len >> 9);
+	sampleblk_cbt_mark(sampleblk_dev, start + r.dst, r.len);
+	this_cpu_add(sampleblk_dev->stats->copy_ns, ktime_get_ns() - t);
+	this_cpu_add(sampleblk_dev->stats->copy_bytes, r.len);
+
+	truncate_inode_pages_range(mapping, r.dst, r.dst + r.len - 1);
+	if (whole)
+		truncate_inode_pages_range(whole, start + r.dst,
+			start + r.dst + r.len - 1);
+
+	return 0;
+}
+
+static int sampleblk_ioctl(struct block_device *bdev, fmode_t mode,
+			unsigned command, unsigned long argument)
+{
+	void __user *argp = (void __user *)argument;
+
+	switch (command) {
+	case SAMPLEBLK_IOC_COPY:
+		if (!(mode & FMODE_WRITE))
+			return -EBADF;
+		return sampleblk_ioctl_copy(bdev, argp);
+	case SAMPLEBLK_IOC_CBT_GET:
+		/* The bitmap covers the whole disk */
+		if (bdev != bdev->bd_contains)
+			return -EINVAL;
+		return sampleblk_cbt_get(bdev->bd_disk->private_data, argp,
+			mode & FMODE_WRITE);
+	}
+
+	return -ENOTTY;
+}
+
+static int sampleblk_open(struct block_device *bdev, fmode_t mode)
+{
+	return 0;
+}
+
+static void sampleblk_release(struct gendisk *disk, fmode_t mode)
+{
+}
+
+static const struct block_device_operations sampleblk_fops = {
+	.owner = THIS_MODULE,
+	.open = sampleblk_open,
+	.release = sampleblk_release,
+	.ioctl = sampleblk_ioctl,
+};
+
+static int sampleblk_alloc(int minor)
+{
+	struct gendisk *disk;
+	int rv = 0;
+
+	sampleblk_dev = kzalloc(sizeof(struct sampleblk_dev), GFP_KERNEL);
+	if (!sampleblk_dev) {
+		rv = -ENOMEM;
+		goto fail;
+	}
+
+	rv = sampleblk_alloc_stripes(sampleblk_dev);
+	if (rv)
+		goto fail_dev;
+	sampleblk_dev->minor = minor;
+
+	rv = sampleblk_cbt_init(sampleblk_dev);
+	if (rv)
+		goto fail_data;
+
+	sampleblk_dev->stats = alloc_percpu(struct sampleblk_stats);
+	if (!sampleblk_dev->stats) {
+		rv = -ENOMEM;
+		goto fail_cbt;
+	}
+
+	rv = sampleblk_qos_init(sampleblk_dev);
+	if (rv)
+		goto fail_stats;
+
+	rv = sampleblk_ctx_init(sampleblk_dev);
+	if (rv)
+		goto fail_qos;
+
+	spin_lock_init(&sampleblk_dev->lock);
+	bio_list_init(&sampleblk_dev->throttled);
+	INIT_DELAYED_WORK(&sampleblk_dev->throttle_work,
+		sampleblk_throttle_workfn);
+	sampleblk_dev->queue = sampleblk_alloc_queue(sampleblk_dev);
+	if (!sampleblk_dev->queue) {
+		rv = -ENOMEM;
+		goto fail_ctx;
+	}
+	sampleblk_dev->queue->queuedata = sampleblk_dev;
+
+	sampleblk_set_limits(sampleblk_dev->queue);
+
+	disk = alloc_disk(minor);
+	if (!disk) {
+		rv = -ENOMEM;
+		goto fail_queue;
+	}
+	sampleblk_dev->disk = disk;
+
+	disk->major = sampleblk_major;
+	disk->first_minor = minor;
+	disk->fops = &sampleblk_fops;
+	disk->private_data = sampleblk_dev;
+	disk->queue = sampleblk_dev->queue;
+	sprintf(disk->disk_name, "sampleblk%d", minor);
+	set_capacity(disk, sampleblk_dev->size / sampleblk_sect_size);
+
+	/* Only blk_queue_bio prepares the integrity payload of a bio */
+	if (queue_mode == SAMPLEBLK_Q_BIO)
+		pr_info("sampleblk: no integrity support in bio mode\n");
+	else
+		rv = sampleblk_integrity_init(sampleblk_dev);
+	if (rv)
+		goto fail_disk;
+
+	rv = sampleblk_selftest(sampleblk_dev);
+	if (rv) {
+		sampleblk_integrity_free(sampleblk_dev);
+		goto fail_disk;
+	}
+
+	sampleblk_register_tps(sampleblk_dev);
+	add_disk(disk);
+	sampleblk_debugfs_init(sampleblk_dev);
+	if (sampleblk_qos_sysfs_init(sampleblk_dev))
+		pr_warn("sampleblk: no qos limits for %s\n", disk->disk_name);
+	if (sampleblk_memdev_init(sampleblk_dev))
+		pr_warn("sampleblk: %s_mem not available\n", disk->disk_name);
+
+	return 0;
+
+fail_disk:
+	put_disk(disk);
+fail_queue:
+	blk_cleanup_queue(sampleblk_dev->queue);
+fail_ctx:
+	sampleblk_ctx_free(sampleblk_dev);
+fail_qos:
+	sampleblk_qos_free(sampleblk_dev);
+fail_stats:
+	free_percpu(sampleblk_dev->stats);
+fail_cbt:
+	sampleblk_cbt_free(sampleblk_dev);
+fail_data:
+	sampleblk_free_stripes(sampleblk_dev);
+fail_dev:
+	kfree(sampleblk_dev);
+	sampleblk_dev = NULL;
+fail:
+	return rv;
+}
+
+static void sampleblk_free(struct sampleblk_dev *sampleblk_dev)
+{
+	sampleblk_memdev_free(sampleblk_dev);
+	debugfs_remove_recursive(sampleblk_dev->debugfs_dir);
+	sampleblk_qos_sysfs_free(sampleblk_dev);
+	del_gendisk(sampleblk_dev->disk);
+	blk_cleanup_queue(sampleblk_dev->queue);
+	cancel_delayed_work_sync(&sampleblk_dev->throttle_work);
+	sampleblk_unregister_tps(sampleblk_dev);
+	sampleblk_integrity_free(sampleblk_dev);
+	put_disk(sampleblk_dev->disk);
+	sampleblk_ctx_free(sampleblk_dev);
+	sampleblk_qos_free(sampleblk_dev);
+	free_percpu(sampleblk_dev->stats);
+	sampleblk_cbt_free(sampleblk_dev);
+	sampleblk_free_stripes(sampleblk_dev);
+	kfree(sampleblk_dev);
+}
+
+static int __init sampleblk_init(void)
+{
+	int rv = 0;
+
+	sampleblk_major = register_blkdev(0, "sampleblk");
+	if (sampleblk_major < 0)
+		return sampleblk_major;
+
+	/* Writeback can depend on the stripe copies, so keep a rescuer */
+	sampleblk_wq = alloc_workqueue("sampleblk",
+		WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!sampleblk_wq) {
+		unregister_blkdev(sampleblk_major, "sampleblk");
+		return -ENOMEM;
+	}
+
+	sampleblk_debugfs_root = debugfs_create_dir("sampleblk", NULL);
+
+	rv = sampleblk_alloc(SAMPLEBLK_MINOR);
+	if (rv < 0) {
+		pr_info("sampleblk: disk allocation failed with %d\n", rv);
+		goto fail;
+	}
+
+	pr_info("sampleblk: module loaded\n");
+	return 0;
+
+fail:
+	debugfs_remove_recursive(sampleblk_debugfs_root);
+	destroy_workqueue(sampleblk_wq);
+	unregister_blkdev(sampleblk_major, "sampleblk");
+	return rv;
+}
+
+static void __exit sampleblk_exit(void)
+{
+	sampleblk_free(sampleblk_dev);
+	unregister_blkdev(sampleblk_major, "sampleblk");
+	debugfs_remove_recursive(sampleblk_debugfs_root);
+	destroy_workqueue(sampleblk_wq);
+
+	pr_info("sampleblk: module unloaded\n");
+}
+
+module_init(sampleblk_init);
+module_exit(sampleblk_exit);
+MODULE_LICENSE("GPL");
@@ -0,0 +1,256 @@
+/*
+ *   blk/sampleblk/sample_blk.h
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   Primitive example to show how to create a Linux block driver
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _SAMPLE_BLK_H
+#define _SAMPLE_BLK_H
+
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/workqueue.h>
+#include <linux/percpu.h>
+#include <linux/miscdevice.h>
+
+/* Stripes are spread over the online NUMA nodes round robin */
+#define SAMPLEBLK_MAX_STRIPES	8
+
+/* ioprio lanes, and log2 latency buckets from <1us to >=4s per class */
+#define SAMPLEBLK_PRIO_RT	0
+#define SAMPLEBLK_PRIO_BE	1
+#define SAMPLEBLK_PRIO_IDLE	2
+#define SAMPLEBLK_PRIO_CLASSES	3
+#define SAMPLEBLK_LAT_BUCKETS	24
+
+/* Integrity verify time is kept per I/O size, 512B to 1MB and above */
+#define SAMPLEBLK_PI_SIZES	12
+
+/*
+ * QoS token buckets. Bytes limits are even and I/O limits odd, so an I/O
+ * takes bytes or 1 token depending on the low bit.
+ */
+#define SAMPLEBLK_QOS_READ_BPS		0
+#define SAMPLEBLK_QOS_READ_IOPS		1
+#define SAMPLEBLK_QOS_WRITE_BPS		2
+#define SAMPLEBLK_QOS_WRITE_IOPS	3
+#define SAMPLEBLK_QOS_BPS		4
+#define SAMPLEBLK_QOS_IOPS		5
+#define SAMPLEBLK_QOS_NR		6
+
+/* All fields are u64 so they can be summed up as an array */
+struct sampleblk_stats {
+	u64 requests;
+	u64 bios;
+	u64 splits;
+	u64 back_merges;
+	u64 front_merges;
+	u64 stripe_works;
+	u64 copy_bytes;
+	u64 copy_ns;
+	u64 pi_errors;
+	u64 pi_ios[SAMPLEBLK_PI_SIZES];
+	u64 pi_ns[SAMPLEBLK_PI_SIZES];
+	u64 prio_ios[SAMPLEBLK_PRIO_CLASSES];
+	u64 prio_lat[SAMPLEBLK_PRIO_CLASSES][SAMPLEBLK_LAT_BUCKETS];
+	u64 throttle_events[2];
+	u64 throttled_ns[2];
+	u64 service_ns[2];
+	u64 ctx_allocs;
+};
+
+struct sampleblk_lanes {
+	struct list_head lane[SAMPLEBLK_PRIO_CLASSES];
+	unsigned int credit[SAMPLEBLK_PRIO_CLASSES];
+};
+
+struct sampleblk_tb {
+	u64 rate;		/* tokens per second, 0 is unlimited */
+	u64 burst;
+	spinlock_t lock;
+	s64 tokens;		/* below 0 after an I/O larger than burst */
+	u64 last_ns;
+	u64 __percpu *cache;
+};
+
+struct sampleblk_qos {
+	struct sampleblk_tb tb[SAMPLEBLK_QOS_NR];
+	atomic64_t throttle_start[2];
+	bool sysfs;
+};
+
+/* Per-I/O state, from the preallocated pool unless tag is -1 */
+struct sampleblk_ctx {
+	u64 issue_ns;
+	unsigned int bytes;
+	int dir;
+	int tag;
+};
+
+struct sampleblk_ctx_pool {
+	unsigned int depth;
+	unsigned long *map;
+	struct sampleblk_ctx *ctx;
+	unsigned int __percpu *hint;
+};
+
+struct sampleblk_stripe {
+	int node;
+	spinlock_t lock;
+	void *data;
+};
+
+struct sampleblk_dev {
+	int minor;
+	spinlock_t lock;
+	struct request_queue *queue;
+	struct gendisk *disk;
+	ssize_t size;
+	int nr_stripes;
+	unsigned int chunk_sects;
+	struct sampleblk_stripe stripes[SAMPLEBLK_MAX_STRIPES];
+	void *pi;
+	unsigned long *cbt;
+	unsigned long cbt_bits;
+	int cbt_shift;
+	struct sampleblk_stats __percpu *stats;
+	struct sampleblk_qos qos;
+	struct bio_list throttled;	/* bio mode, under lock */
+	struct delayed_work throttle_work;
+	struct sampleblk_ctx_pool ctx_pool;
+	struct dentry *debugfs_dir;
+	struct miscdevice memdev;
+	char memdev_name[DISK_NAME_LEN + 4];
+};
+
+/*
+ * Find the stripe holding byte pos of the disk. Returns the offset into
+ * that stripe's store and how many bytes are left before the chunk ends.
+ * The flat layout is a single stripe with one chunk covering the disk.
+ */
+static inline struct sampleblk_stripe *
+sampleblk_map(struct sampleblk_dev *dev, uint64_t pos, size_t *off,
+		size_t *len)
+{
+	sector_t chunk = pos >> 9;
+	unsigned int sect_in_chunk = sector_div(chunk, dev->chunk_sects);
+	unsigned int idx = sector_div(chunk, dev->nr_stripes);
+
+	*off = (((size_t)chunk * dev->chunk_sects + sect_in_chunk) << 9) +
+		(pos & 511);
+	*len = ((size_t)(dev->chunk_sects - sect_in_chunk) << 9) - (pos & 511);
+
+	return &dev->stripes[idx];
+}
+
+static inline void *sampleblk_addr(struct sampleblk_dev *dev, sector_t sector)
+{
+	size_t off, len;
+
+	return sampleblk_map(dev, (uint64_t)sector << 9, &off, &len)->data +
+		off;
+}
+
+/* Also catches a length that wraps pos around */
+static inline bool sampleblk_beyond_end(struct sampleblk_dev *dev,
+		uint64_t pos, uint64_t len)
+{
+	return pos > dev->size || len > dev->size - pos;
+}
+
+extern int sampleblk_handle_io(struct sampleblk_dev *sampleblk_dev,
+		uint64_t pos, ssize_t size, void *buffer, int write,
+		struct sampleblk_stripe *only);
+extern int sampleblk_copy_striped(struct sampleblk_dev *sampleblk_dev,
+		struct bio *bio, sector_t sector, unsigned int nr_sects);
+extern void sampleblk_run_queue(struct sampleblk_dev *sampleblk_dev);
+extern int sampleblk_selftest(struct sampleblk_dev *dev);
+
+extern void sampleblk_lanes_init(struct sampleblk_lanes *lanes);
+extern void sampleblk_lanes_add(struct sampleblk_lanes *lanes,
+		struct request *rq);
+extern void sampleblk_lanes_putback(struct sampleblk_lanes *lanes,
+		struct request *rq);
+extern struct request *sampleblk_lanes_next(struct sampleblk_lanes *lanes);
+extern void sampleblk_prio_account(struct sampleblk_dev *dev,
+		struct request *rq);
+
+extern void sampleblk_lanes_requeue(struct request_queue *q,
+		struct sampleblk_lanes *lanes);
+
+extern int sampleblk_ctx_init(struct sampleblk_dev *dev);
+extern void sampleblk_ctx_free(struct sampleblk_dev *dev);
+extern struct sampleblk_ctx *sampleblk_ctx_get(struct sampleblk_dev *dev,
+		int dir, unsigned int bytes);
+extern void sampleblk_ctx_put(struct sampleblk_dev *dev,
+		struct sampleblk_ctx *ctx);
+extern void sampleblk_ctx_complete(struct sampleblk_dev *dev,
+		struct sampleblk_ctx *ctx);
+
+extern int sampleblk_qos_init(struct sampleblk_dev *dev);
+extern void sampleblk_qos_free(struct sampleblk_dev *dev);
+extern int sampleblk_qos_sysfs_init(struct sampleblk_dev *dev);
+extern void sampleblk_qos_sysfs_free(struct sampleblk_dev *dev);
+extern bool sampleblk_qos_allow(struct sampleblk_dev *dev, int dir,
+		unsigned int bytes);
+extern void sampleblk_qos_set(struct sampleblk_dev *dev, int tb, u64 rate,
+		u64 burst);
+
+struct sampleblk_cbt;
+
+extern int sampleblk_cbt_init(struct sampleblk_dev *dev);
+extern void sampleblk_cbt_free(struct sampleblk_dev *dev);
+extern void sampleblk_cbt_mark(struct sampleblk_dev *dev, uint64_t pos,
+		uint64_t len);
+extern int sampleblk_cbt_get(struct sampleblk_dev *dev,
+		struct sampleblk_cbt __user *argp, bool writable);
+
+extern int sampleblk_memdev_init(struct sampleblk_dev *dev);
+extern void sampleblk_memdev_free(struct sampleblk_dev *dev);
+
+#ifdef CONFIG_BLK_DEV_INTEGRITY
+extern int sampleblk_integrity_init(struct sampleblk_dev *dev);
+extern void sampleblk_integrity_free(struct sampleblk_dev *dev);
+extern int sampleblk_integrity_rq(struct sampleblk_dev *dev,
+		struct request *rq);
+extern void sampleblk_integrity_copy(struct sampleblk_dev *dev,
+		sector_t src, sector_t dst, sector_t nr_sects);
+#else
+static inline int sampleblk_integrity_init(struct sampleblk_dev *dev)
+{
+	return 0;
+}
+
+static inline void sampleblk_integrity_free(struct sampleblk_dev *dev)
+{
+}
+
+static inline int sampleblk_integrity_rq(struct sampleblk_dev *dev,
+		struct request *rq)
+{
+	return 0;
+}
+
+static inline void sampleblk_integrity_copy(struct sampleblk_dev *dev,
+		sector_t src, sector_t dst, sector_t nr_sects)
+{
+}
+#endif
+
+#endif /* _SAMPLE_BLK_H */
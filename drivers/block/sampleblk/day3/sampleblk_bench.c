@@ -0,0 +1,477 @@
+/*
+ *   blk/sampleblk/sampleblk_bench.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   In-kernel I/O load generator for sampleblk
+ *
+ *   Submits bios straight to a block device from kernel threads, so the
+ *   driver can be measured without the syscall and VFS cost that fio with
+ *   ioengine=sync pays for every I/O. Usage is similar to dmatest:
+ *
+ *	cd /sys/module/sampleblk_bench/parameters
+ *	echo randread > rw; echo 4096 > bs; echo 8 > iodepth
+ *	echo 4 > numjobs; echo 10 > runtime
+ *	echo 1 > run; cat result
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/semaphore.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+
+static char device[64] = "/dev/sampleblk1";
+module_param_string(device, device, sizeof(device), 0644);
+MODULE_PARM_DESC(device, "Block device to run against");
+
+static char rw[16] = "read";
+module_param_string(rw, rw, sizeof(rw), 0644);
+MODULE_PARM_DESC(rw, "read, write, randread, randwrite, rw or randrw");
+
+static unsigned int rwmixread = 50;
+module_param(rwmixread, uint, 0644);
+MODULE_PARM_DESC(rwmixread, "Percentage of reads for rw and randrw");
+
+static unsigned int bs = 4096;
+module_param(bs, uint, 0644);
+MODULE_PARM_DESC(bs, "I/O size in bytes, multiple of 512");
+
+static unsigned int iodepth = 1;
+module_param(iodepth, uint, 0644);
+MODULE_PARM_DESC(iodepth, "In-flight I/Os per thread");
+
+static unsigned int numjobs = 1;
+module_param(numjobs, uint, 0644);
+MODULE_PARM_DESC(numjobs, "Number of submitting threads");
+
+static unsigned int runtime = 10;
+module_param(runtime, uint, 0644);
+MODULE_PARM_DESC(runtime, "Run time in seconds");
+
+/*
+ * Latency histogram with 8 linear buckets per power of two, like fio's
+ * clat percentiles, so every bucket is within 12.5% of the real value.
+ */
+#define BENCH_HIST_SUB_BITS	3
+#define BENCH_HIST_SUB		(1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS	320
+
+struct bench_hist {
+	u64 bucket[BENCH_HIST_BUCKETS];
+	u64 total_ns;
+	u64 reads;
+	u64 writes;
+	u64 errors;
+};
+
+struct bench_run {
+	struct block_device *bdev;
+	sector_t nr_sects;
+	int random;
+	int mixed;
+	int write;
+	unsigned int depth;
+	u64 deadline;
+	struct bench_hist __percpu *hist;
+};
+
+struct bench_thread {
+	struct bench_run *run;
+	sector_t next;
+	sector_t start;
+	sector_t end;
+	struct page **pages;
+	int nr_pages;
+	struct semaphore slots;
+	struct completion done;
+};
+
+/* Per-I/O context, carved out of the bio front pad */
+struct bench_io {
+	struct bench_thread *t;
+	u64 start_ns;
+	struct bio bio;
+};
+
+static struct bio_set *bench_bio_set;
+/* About 150 chars of text plus 13 u64 values of up to 20 digits each */
+static char result[512];
+
+static int bench_hist_index(u64 ns)
+{
+	int msb, idx;
+
+	if (ns < 2 * BENCH_HIST_SUB)
+		return ns;
+
+	msb = fls64(ns) - 1;
+	idx = 2 * BENCH_HIST_SUB + (msb - BENCH_HIST_SUB_BITS - 1) *
+		BENCH_HIST_SUB + ((ns >> (msb - BENCH_HIST_SUB_BITS)) &
+		(BENCH_HIST_SUB - 1));
+
+	return min(idx, BENCH_HIST_BUCKETS - 1);
+}
+
+/* Upper bound in ns of a histogram bucket */
+static u64 bench_hist_value(int idx)
+{
+	int msb, sub;
+
+	if (idx < 2 * BENCH_HIST_SUB)
+		return idx;
+
+	msb = (idx - 2 * BENCH_HIST_SUB) / BENCH_HIST_SUB +
+		BENCH_HIST_SUB_BITS + 1;
+	sub = (idx - 2 * BENCH_HIST_SUB) % BENCH_HIST_SUB;
+
+	return ((u64)(BENCH_HIST_SUB + sub + 1) << (msb - BENCH_HIST_SUB_BITS))
+		- 1;
+}
+
+static void bench_end_io(struct bio *bio)
+{
+	struct bench_io *io = container_of(bio, struct bench_io, bio);
+	struct bench_thread *t = io->t;
+	struct bench_hist __percpu *hist = t->run->hist;
+	u64 ns = ktime_get_ns() - io->start_ns;
+
+	if (bio->bi_error)
+		this_cpu_inc(hist->errors);
+	else if (bio_data_dir(bio) == WRITE)
+		this_cpu_inc(hist->writes);
+	else
+		this_cpu_inc(hist->reads);
+	this_cpu_add(hist->total_ns, ns);
+	this_cpu_inc(hist->bucket[bench_hist_index(ns)]);
+
+	bio_put(bio);
+
+	/* Last thing touching the thread, it may go away right after */
+	up(&t->slots);
+}
+
+static sector_t bench_next_sector(struct bench_thread *t)
+{
+	struct bench_run *run = t->run;
+	sector_t sect = t->next;
+	sector_t nr_ios = div_u64(t->end - t->start, bs >> 9);
+
+	if (run->random) {
+		sect = t->start + (sector_t)prandom_u32_max(nr_ios) * (bs >> 9);
+	} else {
+		t->next += bs >> 9;
+		if (t->next + (bs >> 9) > t->end)
+			t->next = t->start;
+	}
+
+	return sect;
+}
+
+static int bench_submit(struct bench_thread *t)
+{
+	struct bench_run *run = t->run;
+	struct bench_io *io;
+	struct bio *bio;
+	unsigned int left = bs;
+	int write = run->write;
+	int i;
+
+	if (run->mixed)
+		write = prandom_u32_max(100) >= rwmixread;
+
+	bio = bio_alloc_bioset(GFP_KERNEL, t->nr_pages, bench_bio_set);
+	if (!bio)
+		return -ENOMEM;
+	io = container_of(bio, struct bench_io, bio);
+	io->t = t;
+
+	bio->bi_bdev = run->bdev;
+	bio->bi_iter.bi_sector = bench_next_sector(t);
+	bio->bi_end_io = bench_end_io;
+	for (i = 0; i < t->nr_pages; i++) {
+		unsigned int len = min_t(unsigned int, left, PAGE_SIZE);
+
+		bio_add_page(bio, t->pages[i], len, 0);
+		left -= len;
+	}
+
+	io->start_ns = ktime_get_ns();
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,8,0)
+	submit_bio(write ? WRITE : READ, bio);
+#else
+	bio_set_op_attrs(bio, write ? REQ_OP_WRITE : REQ_OP_READ, 0);
+	submit_bio(bio);
+#endif
+
+	return 0;
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *t = data;
+	int i;
+
+	/* One semaphore count per iodepth slot, completions give them back */
+	while (ktime_get_ns() < t->run->deadline) {
+		down(&t->slots);
+		if (bench_submit(t)) {
+			up(&t->slots);
+			break;
+		}
+	}
+	for (i = 0; i < t->run->depth; i++)
+		down(&t->slots);
+
+	complete(&t->done);
+	return 0;
+}
+
+static void bench_free_pages(struct bench_thread *t)
+{
+	int i;
+
+	for (i = 0; i < t->nr_pages; i++)
+		if (t->pages[i])
+			__free_page(t->pages[i]);
+	kfree(t->pages);
+}
+
+static int bench_alloc_pages(struct bench_thread *t)
+{
+	int i;
+
+	/* Every in-flight I/O of a thread shares the same data pages */
+	t->nr_pages = DIV_ROUND_UP(bs, PAGE_SIZE);
+	t->pages = kcalloc(t->nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!t->pages)
+		return -ENOMEM;
+
+	for (i = 0; i < t->nr_pages; i++) {
+		t->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (!t->pages[i]) {
+			bench_free_pages(t);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static int bench_parse_rw(struct bench_run *run)
+{
+	const char *mode = strim(rw);
+
+	if (!strcmp(mode, "read")) {
+	} else if (!strcmp(mode, "write")) {
+		run->write = 1;
+	} else if (!strcmp(mode, "randread")) {
+		run->random = 1;
+	} else if (!strcmp(mode, "randwrite")) {
+		run->random = 1;
+		run->write = 1;
+	} else if (!strcmp(mode, "rw")) {
+		run->mixed = 1;
+	} else if (!strcmp(mode, "randrw")) {
+		run->random = 1;
+		run->mixed = 1;
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void bench_report(struct bench_run *run, u64 elapsed_ns)
+{
+	static const unsigned int pct[] = { 5000, 9000, 9900, 9990, 9999 };
+	u64 lat[ARRAY_SIZE(pct)] = { 0 };
+	struct bench_hist sum;
+	u64 ios, seen = 0, max = 0, iops, kbps;
+	int cpu, i, p = 0;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		struct bench_hist *h = per_cpu_ptr(run->hist, cpu);
+
+		for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+			sum.bucket[i] += h->bucket[i];
+		sum.total_ns += h->total_ns;
+		sum.reads += h->reads;
+		sum.writes += h->writes;
+		sum.errors += h->errors;
+	}
+
+	ios = sum.reads + sum.writes + sum.errors;
+	for (i = 0; i < BENCH_HIST_BUCKETS && ios; i++) {
+		if (!sum.bucket[i])
+			continue;
+		seen += sum.bucket[i];
+		max = bench_hist_value(i);
+		while (p < ARRAY_SIZE(pct) && seen * 10000 >= ios * pct[p])
+			lat[p++] = max;
+	}
+
+	iops = div64_u64((sum.reads + sum.writes) * NSEC_PER_SEC, elapsed_ns);
+	kbps = div64_u64((sum.reads + sum.writes) * bs * (NSEC_PER_SEC >> 10),
+		elapsed_ns);
+
+	snprintf(result, sizeof(result),
+		"rw=%s bs=%u iodepth=%u numjobs=%u reads=%llu writes=%llu "
+		"errors=%llu iops=%llu kbps=%llu lat_avg_ns=%llu "
+		"lat_p50_ns=%llu lat_p90_ns=%llu lat_p99_ns=%llu "
+		"lat_p99.9_ns=%llu lat_p99.99_ns=%llu lat_max_ns=%llu\n",
+		strim(rw), bs, iodepth, numjobs, sum.reads, sum.writes,
+		sum.errors, iops, kbps, ios ? div64_u64(sum.total_ns, ios) : 0,
+		lat[0], lat[1], lat[2], lat[3], lat[4], max);
+
+	pr_info("sampleblk_bench: %s", result);
+}
+
+static int bench_do_run(void)
+{
+	struct bench_run run;
+	struct bench_thread *threads;
+	struct task_struct *task;
+	u64 start;
+	int i, started = 0, rv;
+
+	memset(&run, 0, sizeof(run));
+	if (bench_parse_rw(&run) || !bs || bs % 512 ||
+	    bs > BIO_MAX_PAGES * PAGE_SIZE || !iodepth || !numjobs ||
+	    rwmixread > 100)
+		return -EINVAL;
+	run.depth = iodepth;
+
+	run.bdev = blkdev_get_by_path(device, FMODE_READ | FMODE_WRITE |
+		FMODE_EXCL, bench_do_run);
+	if (IS_ERR(run.bdev))
+		return PTR_ERR(run.bdev);
+
+	run.nr_sects = i_size_read(run.bdev->bd_inode) >> 9;
+	if (run.nr_sects < (sector_t)numjobs * (bs >> 9)) {
+		rv = -EINVAL;
+		goto out_put;
+	}
+
+	run.hist = alloc_percpu(struct bench_hist);
+	threads = kcalloc(numjobs, sizeof(*threads), GFP_KERNEL);
+	if (!run.hist || !threads) {
+		rv = -ENOMEM;
+		goto out_free;
+	}
+
+	for (i = 0; i < numjobs; i++) {
+		struct bench_thread *t = &threads[i];
+
+		/* Sequential jobs each stream through their own slice */
+		t->run = &run;
+		t->start = div_u64(run.nr_sects, numjobs) * i;
+		t->end = t->start + div_u64(run.nr_sects, numjobs);
+		t->next = t->start;
+		sema_init(&t->slots, run.depth);
+		init_completion(&t->done);
+		rv = bench_alloc_pages(t);
+		if (rv)
+			goto out_pages;
+	}
+
+	start = ktime_get_ns();
+	run.deadline = start + (u64)runtime * NSEC_PER_SEC;
+	for (; started < numjobs; started++) {
+		task = kthread_run(bench_thread_fn, &threads[started],
+			"sampleblk_bench/%d", started);
+		if (IS_ERR(task)) {
+			/* Stop the ones already running as soon as possible */
+			run.deadline = 0;
+			rv = PTR_ERR(task);
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		wait_for_completion(&threads[i].done);
+
+	if (started == numjobs) {
+		bench_report(&run, ktime_get_ns() - start);
+		rv = 0;
+	}
+
+	i = numjobs;
+out_pages:
+	while (--i >= 0)
+		bench_free_pages(&threads[i]);
+out_free:
+	kfree(threads);
+	free_percpu(run.hist);
+out_put:
+	blkdev_put(run.bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	return rv;
+}
+
+static int bench_run_set(const char *val, const struct kernel_param *kp)
+{
+	bool start;
+	int rv;
+
+	rv = strtobool(val, &start);
+	if (rv)
+		return rv;
+	if (!start)
+		return 0;
+
+	/* Runs synchronously, the write returns once results are ready */
+	return bench_do_run();
+}
+
+static const struct kernel_param_ops bench_run_ops = {
+	.set = bench_run_set,
+	.get = param_get_bool,
+};
+
+static bool bench_start;
+module_param_cb(run, &bench_run_ops, &bench_start, 0644);
+MODULE_PARM_DESC(run, "Write 1 to start a run");
+
+module_param_string(result, result, sizeof(result), 0444);
+MODULE_PARM_DESC(result, "Summary of the last run");
+
+static int __init sampleblk_bench_init(void)
+{
+	bench_bio_set = bioset_create(BIO_POOL_SIZE,
+		offsetof(struct bench_io, bio));
+	if (!bench_bio_set)
+		return -ENOMEM;
+
+	pr_info("sampleblk_bench: module loaded\n");
+	return 0;
+}
+
+static void __exit sampleblk_bench_exit(void)
+{
+	bioset_free(bench_bio_set);
+
+	pr_info("sampleblk_bench: module unloaded\n");
+}
+
+module_init(sampleblk_bench_init);
+module_exit(sampleblk_bench_exit);
+MODULE_LICENSE("GPL");
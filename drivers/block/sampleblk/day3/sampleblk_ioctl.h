@@ -0,0 +1,60 @@
+/*
+ *   blk/sampleblk/sampleblk_ioctl.h
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   ioctl interface shared by the driver and the user space tools
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _SAMPLEBLK_IOCTL_H
+#define _SAMPLEBLK_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define SAMPLEBLK_IOC_MAGIC	0xbb
+
+/* Byte offsets and length, all multiples of 512, ranges must not overlap */
+struct sampleblk_copy_range {
+	__u64 src;
+	__u64 dst;
+	__u64 len;
+};
+
+#define SAMPLEBLK_IOC_COPY	_IOW(SAMPLEBLK_IOC_MAGIC, 1, \
+				     struct sampleblk_copy_range)
+
+/*
+ * Changed block tracking. bitmap points to an array of __u64 words large
+ * enough for nr_bits bits, bit N is bit N % 64 of word N / 64 and covers
+ * bytes [N * granularity, (N + 1) * granularity) of the disk. On return
+ * nr_bits and granularity describe the disk's whole bitmap.
+ */
+struct sampleblk_cbt {
+	__u32 flags;
+	__u32 granularity;
+	__u64 nr_bits;
+	__u64 bitmap;
+};
+
+/* Clear the bits that were returned, needs the disk open for writing */
+#define SAMPLEBLK_CBT_CLEAR	(1 << 0)
+
+#define SAMPLEBLK_IOC_CBT_GET	_IOWR(SAMPLEBLK_IOC_MAGIC, 2, \
+				      struct sampleblk_cbt)
+
+#endif /* _SAMPLEBLK_IOCTL_H */
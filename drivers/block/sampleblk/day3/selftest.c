@@ -0,0 +1,403 @@
+/*
+ *   blk/sampleblk/selftest.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample Block Driver
+ *
+ *   Load time self test of the data movement code, in the spirit of the
+ *   raid6 and xor algorithm checks. It runs on the new store before the
+ *   disk is added, so nothing else can see the test data, and a failure
+ *   makes the module load fail. With selftest=2 every copy strategy is
+ *   also timed for I/O sizes from 512B to 1MB, and the results go to the
+ *   kernel log, so a change to the copy path can be checked and measured
+ *   with one insmod.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/ktime.h>
+#include "sample_blk.h"
+
+static int selftest;
+module_param(selftest, int, 0444);
+MODULE_PARM_DESC(selftest, "1: check copy paths at load, 2: also time them");
+
+#define SELFTEST_BUF_SIZE	(1 << 20)
+#define SELFTEST_BENCH_NS	(10 * NSEC_PER_MSEC)
+
+/* Pattern bytes depend on the disk position and the pass */
+static u8 selftest_byte(uint64_t pos, u8 seed)
+{
+	return (u8)(pos ^ (pos >> 9) ^ seed);
+}
+
+static void selftest_fill(u8 *buf, uint64_t pos, size_t len, u8 seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = selftest_byte(pos + i, seed);
+}
+
+static int selftest_check(const char *name, u8 *buf, uint64_t pos,
+		size_t len, u8 seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != selftest_byte(pos + i, seed)) {
+			pr_err("sampleblk: selftest %s: bad byte at %llu\n",
+				name, pos + i);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Write a guard pattern over one sector on each side of the range, write
+ * the range and read everything back, so an off by one at a chunk or
+ * stripe boundary shows up in the guards.
+ */
+static int selftest_range(struct sampleblk_dev *dev, u8 *buf,
+		const char *name, uint64_t pos, size_t len)
+{
+	uint64_t start = pos >= 512 ? pos - 512 : 0;
+	uint64_t end = min_t(uint64_t, pos + len + 512, dev->size);
+	int rv;
+
+	if (pos + len > dev->size || end - start > SELFTEST_BUF_SIZE)
+		return 0;
+
+	selftest_fill(buf, start, end - start, 0x5a);
+	sampleblk_handle_io(dev, start, end - start, buf, 1, NULL);
+	selftest_fill(buf, pos, len, 0xa5);
+	sampleblk_handle_io(dev, pos, len, buf, 1, NULL);
+
+	memset(buf, 0, end - start);
+	sampleblk_handle_io(dev, start, end - start, buf, 0, NULL);
+	rv = selftest_check(name, buf, start, pos - start, 0x5a);
+	if (!rv)
+		rv = selftest_check(name, buf + (pos - start), pos, len, 0xa5);
+	if (!rv)
+		rv = selftest_check(name, buf + (pos + len - start),
+			pos + len, end - pos - len, 0x5a);
+
+	return rv;
+}
+
+/* The later of two overlapping writes wins where they overlap */
+static int selftest_overlap(struct sampleblk_dev *dev, u8 *buf,
+		uint64_t pos, size_t len)
+{
+	int rv;
+
+	if (pos + 3 * len > dev->size)
+		return 0;
+
+	selftest_fill(buf, pos, 2 * len, 0x11);
+	sampleblk_handle_io(dev, pos, 2 * len, buf, 1, NULL);
+	selftest_fill(buf, pos + len, 2 * len, 0x22);
+	sampleblk_handle_io(dev, pos + len, 2 * len, buf, 1, NULL);
+
+	memset(buf, 0, 3 * len);
+	sampleblk_handle_io(dev, pos, 3 * len, buf, 0, NULL);
+	rv = selftest_check("overlap", buf, pos, len, 0x11);
+	if (!rv)
+		rv = selftest_check("overlap", buf + len, pos + len,
+			2 * len, 0x22);
+
+	return rv;
+}
+
+static int selftest_beyond_end(struct sampleblk_dev *dev)
+{
+	static const struct {
+		int64_t pos;	/* from the end of the disk when negative */
+		uint64_t len;
+		bool beyond;
+	} cases[] = {
+		{ -512, 512, false },
+		{ -511, 512, true },
+		{ 0, 0, false },
+		{ 0, 512, true },
+		{ -512, ~0ULL - 100, true },
+		{ 100, ~0ULL - 50, true },
+	};
+	uint64_t pos;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		pos = dev->size + cases[i].pos;
+		if (sampleblk_beyond_end(dev, pos, cases[i].len) !=
+		    cases[i].beyond) {
+			pr_err("sampleblk: selftest beyond_end case %d\n", i);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A write larger than the burst has to pass on a full bucket, and be
+ * charged in full, which leaves the bucket in debt. At one token per
+ * second no token comes back in between.
+ */
+static int selftest_qos(struct sampleblk_dev *dev)
+{
+	struct sampleblk_tb *tb = &dev->qos.tb[SAMPLEBLK_QOS_WRITE_BPS];
+	s64 left;
+	int cpu, rv = 0;
+
+	sampleblk_qos_set(dev, SAMPLEBLK_QOS_WRITE_BPS, 1, 4096);
+	if (!sampleblk_qos_allow(dev, WRITE, 65536)) {
+		pr_err("sampleblk: selftest qos: I/O over the burst throttled\n");
+		rv = -EIO;
+	} else if (sampleblk_qos_allow(dev, WRITE, 512)) {
+		pr_err("sampleblk: selftest qos: bucket not charged\n");
+		rv = -EIO;
+	}
+
+	if (!rv) {
+		spin_lock_irq(&tb->lock);
+		left = tb->tokens;
+		for_each_possible_cpu(cpu)
+			left += *per_cpu_ptr(tb->cache, cpu);
+		spin_unlock_irq(&tb->lock);
+		if (left >= 0) {
+			pr_err("sampleblk: selftest qos: %lld tokens left, not in debt\n",
+				left);
+			rv = -EIO;
+		}
+	}
+	sampleblk_qos_set(dev, SAMPLEBLK_QOS_WRITE_BPS, 0, 0);
+	atomic64_set(&dev->qos.throttle_start[WRITE], 0);
+
+	return rv;
+}
+
+static void selftest_set_dir(struct bio *bio, int write)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,8,0)
+	bio->bi_rw = write ? WRITE : READ;
+#else
+	bio_set_op_attrs(bio, write ? REQ_OP_WRITE : REQ_OP_READ, 0);
+#endif
+}
+
+/* One bio segment per page of a vmalloc buffer */
+static struct bio *selftest_bio(void *buf, size_t len, sector_t sector)
+{
+	struct bio *bio;
+	size_t off;
+
+	bio = bio_kmalloc(GFP_KERNEL, DIV_ROUND_UP(len, PAGE_SIZE));
+	if (!bio)
+		return NULL;
+
+	for (off = 0; off < len; off += PAGE_SIZE)
+		bio_add_page(bio, vmalloc_to_page(buf + off),
+			min_t(size_t, len - off, PAGE_SIZE), 0);
+	bio->bi_iter.bi_sector = sector;
+
+	return bio;
+}
+
+/*
+ * Segments of odd lengths at odd page offsets, across a chunk boundary,
+ * through the same path as requests. With stripes the other stripes are
+ * copied by the workers.
+ */
+static int selftest_segments(struct sampleblk_dev *dev, u8 *buf)
+{
+	static const struct {
+		unsigned int off;	/* in the page of the segment */
+		unsigned int len;
+	} segs[] = {
+		{ 512, 1536 },
+		{ 0, 512 },
+		{ 3584, 512 },
+		{ 1024, 2048 },
+	};
+	sector_t sector = min_t(sector_t, dev->chunk_sects,
+		(dev->size >> 9) / 2) - 3;
+	uint64_t pos = (uint64_t)sector << 9;
+	u8 *flat = buf + ARRAY_SIZE(segs) * PAGE_SIZE;
+	size_t len = 0;
+	struct bio *bio;
+	int i, rv = 0;
+
+	bio = bio_kmalloc(GFP_KERNEL, ARRAY_SIZE(segs));
+	if (!bio)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(segs); i++) {
+		bio_add_page(bio, vmalloc_to_page(buf + i * PAGE_SIZE),
+			segs[i].len, segs[i].off);
+		selftest_fill(buf + i * PAGE_SIZE + segs[i].off, pos + len,
+			segs[i].len, 0x33);
+		len += segs[i].len;
+	}
+	bio->bi_iter.bi_sector = sector;
+	if (pos + len > dev->size)
+		goto out;
+
+	selftest_set_dir(bio, 1);
+	sampleblk_copy_striped(dev, bio, sector, len >> 9);
+	memset(flat, 0, len);
+	sampleblk_handle_io(dev, pos, len, flat, 0, NULL);
+	rv = selftest_check("segments write", flat, pos, len, 0x33);
+	if (rv)
+		goto out;
+
+	memset(buf, 0, ARRAY_SIZE(segs) * PAGE_SIZE);
+	selftest_set_dir(bio, 0);
+	sampleblk_copy_striped(dev, bio, sector, len >> 9);
+	for (i = 0, len = 0; !rv && i < ARRAY_SIZE(segs); i++) {
+		rv = selftest_check("segments read",
+			buf + i * PAGE_SIZE + segs[i].off, pos + len,
+			segs[i].len, 0x33);
+		len += segs[i].len;
+	}
+out:
+	bio_put(bio);
+	return rv;
+}
+
+enum {
+	SELFTEST_MEMCPY,
+	SELFTEST_HANDLE_IO,
+	SELFTEST_BIO_STRIPED,
+	SELFTEST_NR_STRATEGIES,
+};
+
+static const char * const selftest_strategies[] = {
+	"memcpy", "handle_io", "bio_striped",
+};
+
+static void selftest_run_once(struct sampleblk_dev *dev, int strategy,
+		u8 *buf, struct bio *bio, size_t len)
+{
+	switch (strategy) {
+	case SELFTEST_MEMCPY:
+		memcpy(dev->stripes[0].data, buf, len);
+		break;
+	case SELFTEST_HANDLE_IO:
+		sampleblk_handle_io(dev, 0, len, buf, 1, NULL);
+		break;
+	case SELFTEST_BIO_STRIPED:
+		sampleblk_copy_striped(dev, bio, 0, len >> 9);
+		break;
+	}
+}
+
+/*
+ * Time writes of each size with each strategy. memcpy into the first
+ * stripe is the baseline the others are compared with.
+ */
+static void selftest_bench(struct sampleblk_dev *dev, u8 *buf)
+{
+	size_t stripe_size = dev->size / dev->nr_stripes;
+	u64 start, ns, ops;
+	struct bio *bio;
+	size_t len;
+	int i;
+
+	for (len = 512; len <= SELFTEST_BUF_SIZE && len <= stripe_size;
+	     len <<= 1) {
+		bio = selftest_bio(buf, len, 0);
+		if (!bio)
+			return;
+		selftest_set_dir(bio, 1);
+
+		for (i = 0; i < SELFTEST_NR_STRATEGIES; i++) {
+			ops = 0;
+			start = ktime_get_ns();
+			do {
+				selftest_run_once(dev, i, buf, bio, len);
+				ops++;
+				ns = ktime_get_ns() - start;
+			} while (ns < SELFTEST_BENCH_NS);
+
+			pr_info("sampleblk: %-11s %7zu bytes %9llu ns/op %6llu MB/s\n",
+				selftest_strategies[i], len, div64_u64(ns, ops),
+				div64_u64(ops * len * 1000, ns));
+			cond_resched();
+		}
+
+		bio_put(bio);
+	}
+}
+
+int sampleblk_selftest(struct sampleblk_dev *dev)
+{
+	uint64_t chunk = (uint64_t)dev->chunk_sects << 9;
+	u8 *buf;
+	int cpu, i, rv;
+
+	if (!selftest)
+		return 0;
+
+	buf = vmalloc(SELFTEST_BUF_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	rv = selftest_range(dev, buf, "first sector", 0, 512);
+	if (!rv)
+		rv = selftest_range(dev, buf, "unaligned", 1, 511);
+	if (!rv)
+		rv = selftest_range(dev, buf, "chunk boundary",
+			chunk - 512, 1024);
+	if (!rv)
+		rv = selftest_range(dev, buf, "odd chunk boundary",
+			chunk - 3, 7);
+	if (!rv)
+		rv = selftest_range(dev, buf, "multi chunk",
+			chunk / 2, 3 * chunk);
+	if (!rv)
+		rv = selftest_range(dev, buf, "last sector",
+			dev->size - 512, 512);
+	if (!rv)
+		rv = selftest_overlap(dev, buf,
+			min_t(uint64_t, chunk, dev->size / 2) - 2048, 4096);
+	if (!rv)
+		rv = selftest_beyond_end(dev);
+	if (!rv)
+		rv = selftest_segments(dev, buf);
+	if (!rv)
+		rv = selftest_qos(dev);
+
+	if (!rv) {
+		pr_info("sampleblk: selftest passed\n");
+		if (selftest > 1)
+			selftest_bench(dev, buf);
+	}
+	vfree(buf);
+
+	/* Start with an empty disk and clean counters */
+	for (i = 0; i < dev->nr_stripes; i++)
+		memset(dev->stripes[i].data, 0, dev->size / dev->nr_stripes);
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(dev->stats, cpu), 0,
+			sizeof(struct sampleblk_stats));
+
+	return rv;
+}
@@ -0,0 +1,91 @@
+/*
+ *   blk/sampleblk/tools/sampleblk_cbt.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Print the changed regions of a sampleblk disk as "offset length" byte
+ *   ranges, one per line, merging adjacent changed bits. With -c the
+ *   bitmap is cleared as it is fetched, for the next incremental export.
+ *
+ *	sampleblk_cbt -c /dev/sampleblk1 | while read off len; do
+ *		dd if=/dev/sampleblk1 of=img bs=512 conv=notrunc \
+ *		   skip=$((off / 512)) seek=$((off / 512)) count=$((len / 512))
+ *	done
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "sampleblk_ioctl.h"
+
+int main(int argc, char **argv)
+{
+	struct sampleblk_cbt c;
+	unsigned long long bit, start = 0, run = 0;
+	uint64_t *bitmap;
+	int clear = 0, fd;
+
+	if (argc > 1 && !strcmp(argv[1], "-c")) {
+		clear = 1;
+		argc--;
+		argv++;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "usage: sampleblk_cbt [-c] <dev>\n");
+		return 1;
+	}
+
+	fd = open(argv[1], clear ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	/* First call only asks for the size of the bitmap */
+	memset(&c, 0, sizeof(c));
+	if (ioctl(fd, SAMPLEBLK_IOC_CBT_GET, &c)) {
+		perror("SAMPLEBLK_IOC_CBT_GET");
+		return 1;
+	}
+
+	bitmap = calloc((c.nr_bits + 63) / 64, sizeof(uint64_t));
+	if (!bitmap)
+		return 1;
+	c.flags = clear ? SAMPLEBLK_CBT_CLEAR : 0;
+	c.bitmap = (uintptr_t)bitmap;
+	if (ioctl(fd, SAMPLEBLK_IOC_CBT_GET, &c)) {
+		perror("SAMPLEBLK_IOC_CBT_GET");
+		return 1;
+	}
+
+	for (bit = 0; bit <= c.nr_bits; bit++) {
+		if (bit < c.nr_bits && (bitmap[bit / 64] >> (bit % 64)) & 1) {
+			if (!run++)
+				start = bit;
+		} else if (run) {
+			printf("%llu %llu\n", start * c.granularity,
+				run * c.granularity);
+			run = 0;
+		}
+	}
+
+	free(bitmap);
+	close(fd);
+	return 0;
+}
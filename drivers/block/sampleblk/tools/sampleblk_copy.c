@@ -0,0 +1,108 @@
+/*
+ *   blk/sampleblk/tools/sampleblk_copy.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Copy a range inside a sampleblk disk with SAMPLEBLK_IOC_COPY, or with
+ *   -d the way dd iflag=direct oflag=direct would, and report throughput.
+ *
+ *	sampleblk_copy /dev/sampleblk1 0 2621440 2621440
+ *	sampleblk_copy -d /dev/sampleblk1 0 2621440 2621440
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "sampleblk_ioctl.h"
+
+#define DD_BS	(1024 * 1024)
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int dd_copy(int fd, struct sampleblk_copy_range *r)
+{
+	unsigned long long done;
+	void *buf;
+	ssize_t n;
+
+	if (posix_memalign(&buf, 4096, DD_BS))
+		return -1;
+
+	for (done = 0; done < r->len; done += n) {
+		n = r->len - done < DD_BS ? r->len - done : DD_BS;
+		if (pread(fd, buf, n, r->src + done) != n ||
+		    pwrite(fd, buf, n, r->dst + done) != n) {
+			free(buf);
+			return -1;
+		}
+	}
+
+	free(buf);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sampleblk_copy_range r;
+	unsigned long long start, ns;
+	int dd = 0, fd, rv;
+
+	if (argc > 1 && !strcmp(argv[1], "-d")) {
+		dd = 1;
+		argc--;
+		argv++;
+	}
+	if (argc != 5) {
+		fprintf(stderr, "usage: sampleblk_copy [-d] <dev> <src> <dst> "
+			"<len>\n");
+		return 1;
+	}
+
+	r.src = strtoull(argv[2], NULL, 0);
+	r.dst = strtoull(argv[3], NULL, 0);
+	r.len = strtoull(argv[4], NULL, 0);
+
+	fd = open(argv[1], O_RDWR | (dd ? O_DIRECT : 0));
+	if (fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	start = now_ns();
+	rv = dd ? dd_copy(fd, &r) : ioctl(fd, SAMPLEBLK_IOC_COPY, &r);
+	ns = now_ns() - start;
+	if (rv) {
+		perror(dd ? "copy" : "SAMPLEBLK_IOC_COPY");
+		return 1;
+	}
+
+	printf("mode=%s bytes=%llu ns=%llu mbps=%.1f\n", dd ? "dd" : "ioctl",
+		(unsigned long long)r.len, ns,
+		ns ? r.len * 1000.0 / ns : 0.0);
+
+	close(fd);
+	return 0;
+}
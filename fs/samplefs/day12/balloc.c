@@ -0,0 +1,199 @@
+/*
+ *   fs/samplefs/balloc.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample File System
+ *
+ *   Inode and block allocation of block-backed samplefs. Both bitmaps stay
+ *   in memory as buffers for the whole mount, and are changed in place
+ *   under s_alloc_lock together with the free counts in the superblock.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#include <linux/bitops.h>
+#include "samplefs.h"
+
+/* First clear bit in [start, nbits) of a bitmap spread over buffers */
+static long sfs_find_zero(struct buffer_head **bhs, unsigned long nbits,
+		unsigned long start)
+{
+	unsigned long n = start;
+	unsigned long base, lim, bit;
+
+	while (n < nbits) {
+		base = n - n % SFS_BITS_PER_BLOCK;
+		lim = min_t(unsigned long, SFS_BITS_PER_BLOCK, nbits - base);
+		bit = ext2_find_next_zero_bit(bhs[base / SFS_BITS_PER_BLOCK]->
+			b_data, lim, n - base);
+		if (bit < lim)
+			return base + bit;
+		n = base + SFS_BITS_PER_BLOCK;
+	}
+
+	return -1;
+}
+
+/* Returns the old value of the bit */
+static int sfs_set_bit(struct buffer_head **bhs, unsigned long n, int set)
+{
+	struct buffer_head *bh = bhs[n / SFS_BITS_PER_BLOCK];
+	int old;
+
+	if (set)
+		old = ext2_set_bit(n % SFS_BITS_PER_BLOCK, bh->b_data);
+	else
+		old = ext2_clear_bit(n % SFS_BITS_PER_BLOCK, bh->b_data);
+	mark_buffer_dirty(bh);
+
+	return old != 0;
+}
+
+static void sfs_add_free(struct buffer_head *sbh, __le32 *count, int delta)
+{
+	*count = cpu_to_le32(le32_to_cpu(*count) + delta);
+	mark_buffer_dirty(sbh);
+}
+
+/* Length of the free run at start, up to max bits */
+static unsigned long sfs_free_run(struct buffer_head **bhs, unsigned long nbits,
+		unsigned long start, unsigned long max)
+{
+	unsigned long n = start;
+
+	while (n < nbits && n - start < max &&
+	       !ext2_test_bit(n % SFS_BITS_PER_BLOCK,
+			      bhs[n / SFS_BITS_PER_BLOCK]->b_data))
+		n++;
+
+	return n - start;
+}
+
+/*
+ * Allocate up to *count contiguous blocks and return the first, or 0 if
+ * the file system is full. A run starting right at goal wins, so a file
+ * growing at its end extends its last extent. Otherwise the first run
+ * after goal long enough for the whole request, and only if there is no
+ * such run, the first free blocks after goal. *count is set to the
+ * number of blocks allocated.
+ */
+unsigned long sfs_new_blocks(struct super_block *sb, unsigned long goal,
+		unsigned long *count)
+{
+	struct sfs_blk_sb_info *sbi = SFS_BLK_SB(sb);
+	unsigned long n, len, i, first = 0, first_len = 0;
+	long block;
+
+	if (goal < sbi->s_first_data || goal >= sbi->s_blocks)
+		goal = sbi->s_first_data;
+
+	mutex_lock(&sbi->s_alloc_lock);
+	n = goal;
+	for (i = 0; i < 2; i++) {
+		while ((block = sfs_find_zero(sbi->s_bbh, i ? goal :
+				sbi->s_blocks, n)) >= 0) {
+			len = sfs_free_run(sbi->s_bbh, sbi->s_blocks, block,
+				*count);
+			if (!first_len) {
+				first = block;
+				first_len = len;
+			}
+			if (len == *count || block == goal) {
+				first = block;
+				first_len = len;
+				goto found;
+			}
+			n = block + len;
+		}
+		n = sbi->s_first_data;
+	}
+	if (!first_len) {
+		mutex_unlock(&sbi->s_alloc_lock);
+		return 0;
+	}
+
+found:
+	for (n = first; n < first + first_len; n++)
+		sfs_set_bit(sbi->s_bbh, n, 1);
+	sfs_add_free(sbi->s_sbh, &sbi->s_ds->s_free_blocks,
+		-(int)first_len);
+	mutex_unlock(&sbi->s_alloc_lock);
+
+	*count = first_len;
+	return first;
+}
+
+void sfs_free_blocks(struct super_block *sb, unsigned long block,
+		unsigned long count)
+{
+	struct sfs_blk_sb_info *sbi = SFS_BLK_SB(sb);
+	unsigned long n, freed = 0;
+
+	if (block < sbi->s_first_data || block + count > sbi->s_blocks ||
+	    block + count < block) {
+		printk(KERN_ERR "samplefs: freeing bad blocks %lu+%lu\n",
+			block, count);
+		return;
+	}
+
+	/* Only blocks that were in use count, so a double free can't skew it */
+	mutex_lock(&sbi->s_alloc_lock);
+	for (n = block; n < block + count; n++)
+		freed += sfs_set_bit(sbi->s_bbh, n, 0);
+	sfs_add_free(sbi->s_sbh, &sbi->s_ds->s_free_blocks, freed);
+	mutex_unlock(&sbi->s_alloc_lock);
+
+	if (freed != count)
+		printk(KERN_ERR "samplefs: %lu of blocks %lu+%lu already free\n",
+			count - freed, block, count);
+}
+
+/* Returns 0 if the inode table is full */
+unsigned long sfs_new_ino(struct super_block *sb)
+{
+	struct sfs_blk_sb_info *sbi = SFS_BLK_SB(sb);
+	long ino;
+
+	mutex_lock(&sbi->s_alloc_lock);
+	ino = sfs_find_zero(sbi->s_ibh, sbi->s_inodes, SFS_FIRST_INO);
+	if (ino < 0) {
+		mutex_unlock(&sbi->s_alloc_lock);
+		return 0;
+	}
+
+	sfs_set_bit(sbi->s_ibh, ino, 1);
+	sfs_add_free(sbi->s_sbh, &sbi->s_ds->s_free_inodes, -1);
+	mutex_unlock(&sbi->s_alloc_lock);
+
+	return ino;
+}
+
+void sfs_free_ino(struct super_block *sb, unsigned long ino)
+{
+	struct sfs_blk_sb_info *sbi = SFS_BLK_SB(sb);
+
+	if (ino < SFS_FIRST_INO || ino >= sbi->s_inodes) {
+		printk(KERN_ERR "samplefs: freeing bad inode %lu\n", ino);
+		return;
+	}
+
+	mutex_lock(&sbi->s_alloc_lock);
+	if (sfs_set_bit(sbi->s_ibh, ino, 0))
+		sfs_add_free(sbi->s_sbh, &sbi->s_ds->s_free_inodes, 1);
+	else
+		printk(KERN_ERR "samplefs: inode %lu already free\n", ino);
+	mutex_unlock(&sbi->s_alloc_lock);
+}
@@ -0,0 +1,532 @@
+/*
+ *   fs/samplefs/bsuper.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample File System
+ *
+ *   Block-backed samplefs, registered as samplefs_blk next to the in
+ *   memory samplefs. It mounts a block device formatted by
+ *   mkfs.samplefs, e.g. an image file on a loop device:
+ *
+ *	truncate -s 64M /tmp/sfs.img
+ *	mkfs.samplefs /tmp/sfs.img
+ *	mount -t samplefs_blk -o loop /tmp/sfs.img /mnt/test
+ *
+ *   This is the 2.6.18 VFS, while sampleblk day3 needs a 4.6 kernel, so
+ *   a sampleblk disk can't back it.
+ *
+ *   Superblock and inode functions.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/buffer_head.h>
+#include <linux/blkdev.h>
+#include <linux/pagemap.h>
+#include <linux/statfs.h>
+#include <linux/nls.h>
+#include <linux/version.h>
+#include "samplefs.h"
+
+extern struct dentry_operations sfs_blk_ci_dentry_ops;
+
+static struct kmem_cache *sfs_inode_cachep;
+
+static struct inode *sfs_blk_alloc_inode(struct super_block *sb)
+{
+	struct sfs_inode_info *si;
+
+	si = kmem_cache_alloc(sfs_inode_cachep, GFP_KERNEL);
+	if (!si)
+		return NULL;
+
+	si->i_ext = si->i_inline;
+	si->i_ext_max = SFS_INLINE_EXTENTS;
+	si->i_ext_count = 0;
+	si->i_ext_block = 0;
+
+	return &si->vfs_inode;
+}
+
+static void sfs_blk_destroy_inode(struct inode *inode)
+{
+	sfs_ext_free(inode);
+	kmem_cache_free(sfs_inode_cachep, SFS_I(inode));
+}
+
+static void sfs_init_once(void *foo, struct kmem_cache *cachep,
+		unsigned long flags)
+{
+	struct sfs_inode_info *si = foo;
+
+	if ((flags & (SLAB_CTOR_VERIFY | SLAB_CTOR_CONSTRUCTOR)) ==
+	    SLAB_CTOR_CONSTRUCTOR) {
+		mutex_init(&si->i_map_lock);
+		inode_init_once(&si->vfs_inode);
+	}
+}
+
+static struct sfs_disk_inode *sfs_raw_inode(struct super_block *sb,
+		unsigned long ino, struct buffer_head **bh)
+{
+	struct sfs_blk_sb_info *sbi = SFS_BLK_SB(sb);
+
+	if (ino < SFS_ROOT_INO || ino >= sbi->s_inodes) {
+		printk(KERN_ERR "samplefs: bad inode number %lu\n", ino);
+		return ERR_PTR(-EIO);
+	}
+
+	*bh = sb_bread(sb, le32_to_cpu(sbi->s_ds->s_inode_table) +
+		ino / SFS_INODES_PER_BLOCK);
+	if (!*bh)
+		return ERR_PTR(-EIO);
+
+	return (struct sfs_disk_inode *)(*bh)->b_data +
+		ino % SFS_INODES_PER_BLOCK;
+}
+
+static void sfs_blk_set_ops(struct inode *inode, dev_t rdev)
+{
+	inode->i_mapping->a_ops = &sfs_blk_aops;
+
+	switch (inode->i_mode & S_IFMT) {
+	case S_IFREG:
+		inode->i_op = &sfs_blk_file_inode_ops;
+		inode->i_fop = &sfs_blk_file_operations;
+		break;
+	case S_IFDIR:
+		inode->i_op = &sfs_blk_dir_inode_ops;
+		inode->i_fop = &sfs_blk_dir_operations;
+		break;
+	case S_IFLNK:
+		inode->i_op = &page_symlink_inode_operations;
+		break;
+	default:
+		init_special_inode(inode, inode->i_mode, rdev);
+		break;
+	}
+}
+
+static int sfs_special(struct inode *inode)
+{
+	return S_ISCHR(inode->i_mode) || S_ISBLK(inode->i_mode) ||
+		S_ISFIFO(inode->i_mode) || S_ISSOCK(inode->i_mode);
+}
+
+struct inode *sfs_blk_iget(struct super_block *sb, unsigned long ino)
+{
+	struct sfs_disk_inode *di;
+	struct buffer_head *bh;
+	struct inode *inode;
+	int rv;
+
+	inode = iget_locked(sb, ino);
+	if (!inode)
+		return ERR_PTR(-ENOMEM);
+	if (!(inode->i_state & I_NEW))
+		return inode;
+
+	di = sfs_raw_inode(sb, ino, &bh);
+	if (IS_ERR(di)) {
+		rv = PTR_ERR(di);
+		goto fail;
+	}
+
+	inode->i_mode = le16_to_cpu(di->i_mode);
+	inode->i_nlink = le16_to_cpu(di->i_nlink);
+	inode->i_uid = le32_to_cpu(di->i_uid);
+	inode->i_gid = le32_to_cpu(di->i_gid);
+	inode->i_size = le64_to_cpu(di->i_size);
+	inode->i_atime.tv_sec = le32_to_cpu(di->i_atime);
+	inode->i_mtime.tv_sec = le32_to_cpu(di->i_mtime);
+	inode->i_ctime.tv_sec = le32_to_cpu(di->i_ctime);
+	inode->i_atime.tv_nsec = 0;
+	inode->i_mtime.tv_nsec = 0;
+	inode->i_ctime.tv_nsec = 0;
+	inode->i_blocks = le32_to_cpu(di->i_blocks) * (SFS_BLOCK_SIZE >> 9);
+	rv = sfs_ext_load(inode, di);
+	if (rv) {
+		brelse(bh);
+		goto fail;
+	}
+
+	sfs_blk_set_ops(inode, sfs_special(inode) ?
+		new_decode_dev(le32_to_cpu(di->i_rdev)) : 0);
+	brelse(bh);
+	unlock_new_inode(inode);
+
+	return inode;
+
+fail:
+	make_bad_inode(inode);
+	unlock_new_inode(inode);
+	iput(inode);
+	return ERR_PTR(rv);
+}
+
+struct inode *sfs_blk_new_inode(struct inode *dir, int mode, dev_t rdev)
+{
+	struct super_block *sb = dir->i_sb;
+	struct inode *inode;
+	unsigned long ino;
+
+	ino = sfs_new_ino(sb);
+	if (!ino)
+		return ERR_PTR(-ENOSPC);
+
+	inode = new_inode(sb);
+	if (!inode) {
+		sfs_free_ino(sb, ino);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	inode->i_ino = ino;
+	inode->i_mode = mode;
+	inode->i_uid = current->fsuid;
+	if (dir->i_mode & S_ISGID) {
+		inode->i_gid = dir->i_gid;
+		if (S_ISDIR(mode))
+			inode->i_mode |= S_ISGID;
+	} else {
+		inode->i_gid = current->fsgid;
+	}
+	inode->i_blocks = 0;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME_SEC;
+	sfs_blk_set_ops(inode, rdev);
+	insert_inode_hash(inode);
+	mark_inode_dirty(inode);
+
+	return inode;
+}
+
+static int sfs_blk_write_inode(struct inode *inode, int wait)
+{
+	struct sfs_disk_inode *di;
+	struct buffer_head *bh;
+	int rv = 0;
+
+	di = sfs_raw_inode(inode->i_sb, inode->i_ino, &bh);
+	if (IS_ERR(di))
+		return PTR_ERR(di);
+
+	di->i_mode = cpu_to_le16(inode->i_mode);
+	di->i_nlink = cpu_to_le16(inode->i_nlink);
+	di->i_uid = cpu_to_le32(inode->i_uid);
+	di->i_gid = cpu_to_le32(inode->i_gid);
+	di->i_size = cpu_to_le64(inode->i_size);
+	di->i_atime = cpu_to_le32(inode->i_atime.tv_sec);
+	di->i_mtime = cpu_to_le32(inode->i_mtime.tv_sec);
+	di->i_ctime = cpu_to_le32(inode->i_ctime.tv_sec);
+	di->i_blocks = cpu_to_le32(inode->i_blocks / (SFS_BLOCK_SIZE >> 9));
+	di->i_rdev = cpu_to_le32(sfs_special(inode) ?
+		new_encode_dev(inode->i_rdev) : 0);
+	sfs_ext_store(inode, di);
+
+	mark_buffer_dirty(bh);
+	if (wait) {
+		sync_dirty_buffer(bh);
+		if (buffer_req(bh) && !buffer_uptodate(bh))
+			rv = -EIO;
+	}
+	brelse(bh);
+
+	return rv;
+}
+
+static void sfs_blk_delete_inode(struct inode *inode)
+{
+	truncate_inode_pages(&inode->i_data, 0);
+
+	if (!is_bad_inode(inode)) {
+		inode->i_size = 0;
+		if (inode->i_blocks)
+			sfs_truncate(inode);
+		sfs_free_ino(inode->i_sb, inode->i_ino);
+	}
+
+	clear_inode(inode);
+}
+
+/* Bitmaps stay in memory for the whole mount, one buffer per block */
+static struct buffer_head **sfs_read_bitmap(struct super_block *sb,
+		unsigned long start, unsigned int n)
+{
+	struct buffer_head **bhs;
+	unsigned int i;
+
+	bhs = kcalloc(n, sizeof(struct buffer_head *), GFP_KERNEL);
+	if (!bhs)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		bhs[i] = sb_bread(sb, start + i);
+		if (!bhs[i]) {
+			while (i--)
+				brelse(bhs[i]);
+			kfree(bhs);
+			return NULL;
+		}
+	}
+
+	return bhs;
+}
+
+static void sfs_put_bitmap(struct buffer_head **bhs, unsigned int n,
+		int sync)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (sync)
+			sync_dirty_buffer(bhs[i]);
+		brelse(bhs[i]);
+	}
+	kfree(bhs);
+}
+
+static void sfs_blk_put_super(struct super_block *sb)
+{
+	struct sfs_blk_sb_info *sbi = SFS_BLK_SB(sb);
+
+	sfs_put_bitmap(sbi->s_bbh,
+		le32_to_cpu(sbi->s_ds->s_block_bitmap_blocks), 1);
+	sfs_put_bitmap(sbi->s_ibh,
+		le32_to_cpu(sbi->s_ds->s_inode_bitmap_blocks), 1);
+	sync_dirty_buffer(sbi->s_sbh);
+	brelse(sbi->s_sbh);
+
+	unload_nls(sbi->opts.local_nls);
+	sb->s_fs_info = NULL;
+	kfree(sbi);
+}
+
+static int sfs_blk_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+	struct sfs_blk_sb_info *sbi = SFS_BLK_SB(dentry->d_sb);
+
+	buf->f_type = SFS_DISK_MAGIC;
+	buf->f_bsize = SFS_BLOCK_SIZE;
+	buf->f_blocks = sbi->s_blocks - sbi->s_first_data;
+	buf->f_bfree = le32_to_cpu(sbi->s_ds->s_free_blocks);
+	buf->f_bavail = buf->f_bfree;
+	buf->f_files = sbi->s_inodes - SFS_FIRST_INO;
+	buf->f_ffree = le32_to_cpu(sbi->s_ds->s_free_inodes);
+	buf->f_namelen = SFS_NAME_LEN;
+
+	return 0;
+}
+
+static struct super_operations sfs_blk_super_ops = {
+	.alloc_inode	= sfs_blk_alloc_inode,
+	.destroy_inode	= sfs_blk_destroy_inode,
+	.write_inode	= sfs_blk_write_inode,
+	.delete_inode	= sfs_blk_delete_inode,
+	.put_super	= sfs_blk_put_super,
+	.statfs		= sfs_blk_statfs,
+	.show_options	= samplefs_show_options,
+};
+
+/* Sanity checks of an on-disk superblock against the device */
+static int sfs_check_super(struct super_block *sb, struct sfs_disk_super *ds,
+		int silent)
+{
+	sector_t dev_blocks = i_size_read(sb->s_bdev->bd_inode) >>
+		SFS_BLOCK_BITS;
+	u32 blocks = le32_to_cpu(ds->s_blocks);
+	u32 inodes = le32_to_cpu(ds->s_inodes);
+	u32 ibh = le32_to_cpu(ds->s_inode_bitmap_blocks);
+	u32 bbh = le32_to_cpu(ds->s_block_bitmap_blocks);
+	u32 bb = le32_to_cpu(ds->s_block_bitmap);
+
+	if (le32_to_cpu(ds->s_magic) != SFS_DISK_MAGIC) {
+		if (!silent)
+			printk(KERN_ERR "samplefs: no samplefs_blk on %s\n",
+				sb->s_id);
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(ds->s_version) != SFS_DISK_VERSION ||
+	    le32_to_cpu(ds->s_block_size) != SFS_BLOCK_SIZE ||
+	    blocks > dev_blocks ||
+	    (u64)ibh * SFS_BITS_PER_BLOCK < inodes ||
+	    (u64)bbh * SFS_BITS_PER_BLOCK < blocks ||
+	    inodes <= SFS_FIRST_INO ||
+	    bb != SFS_INODE_BITMAP + ibh ||
+	    (u64)bb + bbh > le32_to_cpu(ds->s_inode_table) ||
+	    le32_to_cpu(ds->s_first_data) >= blocks) {
+		printk(KERN_ERR "samplefs: bad superblock on %s\n", sb->s_id);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * rsize and wsize bound the I/O samplefs_blk issues: the readahead window,
+ * writeback bios and direct I/O chunks. They are whole blocks, and no
+ * larger than one request of the device, so the block layer never has to
+ * split them.
+ */
+static unsigned int sfs_io_size(struct super_block *sb, unsigned int size)
+{
+	struct request_queue *q = bdev_get_queue(sb->s_bdev);
+	unsigned int max = min_t(unsigned int, SFS_MAX_IO_SIZE,
+		q->max_sectors << 9);
+
+	if (!size)
+		size = SFS_DEF_IO_SIZE;
+	size = min(size, max) & ~(SFS_BLOCK_SIZE - 1);
+
+	return max_t(unsigned int, size, SFS_BLOCK_SIZE);
+}
+
+static int sfs_blk_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct sfs_blk_sb_info *sbi;
+	struct sfs_disk_super *ds;
+	struct inode *root;
+	int rv = -EINVAL;
+
+	sbi = kzalloc(sizeof(struct sfs_blk_sb_info), GFP_KERNEL);
+	if (!sbi)
+		return -ENOMEM;
+	sb->s_fs_info = sbi;
+	mutex_init(&sbi->s_alloc_lock);
+
+	if (!sb_set_blocksize(sb, SFS_BLOCK_SIZE)) {
+		printk(KERN_ERR "samplefs: %s can't do %d byte blocks\n",
+			sb->s_id, SFS_BLOCK_SIZE);
+		goto fail_sbi;
+	}
+
+	sbi->s_sbh = sb_bread(sb, SFS_SUPER_BLOCK);
+	if (!sbi->s_sbh) {
+		rv = -EIO;
+		goto fail_sbi;
+	}
+	ds = sbi->s_ds = (struct sfs_disk_super *)sbi->s_sbh->b_data;
+	rv = sfs_check_super(sb, ds, silent);
+	if (rv)
+		goto fail_sbh;
+
+	sbi->s_blocks = le32_to_cpu(ds->s_blocks);
+	sbi->s_inodes = le32_to_cpu(ds->s_inodes);
+	sbi->s_first_data = le32_to_cpu(ds->s_first_data);
+
+	rv = -EIO;
+	sbi->s_ibh = sfs_read_bitmap(sb, SFS_INODE_BITMAP,
+		le32_to_cpu(ds->s_inode_bitmap_blocks));
+	if (!sbi->s_ibh)
+		goto fail_sbh;
+	sbi->s_bbh = sfs_read_bitmap(sb, le32_to_cpu(ds->s_block_bitmap),
+		le32_to_cpu(ds->s_block_bitmap_blocks));
+	if (!sbi->s_bbh)
+		goto fail_ibh;
+
+	/* 32 bit logical blocks */
+	sb->s_maxbytes = min_t(loff_t, MAX_LFS_FILESIZE,
+		(0xffffffffULL << SFS_BLOCK_BITS) - 1);
+	sb->s_magic = SFS_DISK_MAGIC;
+	sb->s_op = &sfs_blk_super_ops;
+
+	sbi->opts.local_nls = load_nls_default();
+	samplefs_parse_mount_options(data, &sbi->opts);
+	sbi->opts.rsize = sfs_io_size(sb, sbi->opts.rsize);
+	sbi->opts.wsize = sfs_io_size(sb, sbi->opts.wsize);
+	/* The size of the device is the limit */
+	sbi->opts.max_blocks = sbi->opts.max_inodes = 0;
+
+	root = sfs_blk_iget(sb, SFS_ROOT_INO);
+	if (IS_ERR(root)) {
+		rv = PTR_ERR(root);
+		goto fail_nls;
+	}
+	if (!S_ISDIR(root->i_mode)) {
+		printk(KERN_ERR "samplefs: root of %s is no directory\n",
+			sb->s_id);
+		iput(root);
+		goto fail_nls;
+	}
+
+	sb->s_root = d_alloc_root(root);
+	if (!sb->s_root) {
+		iput(root);
+		rv = -ENOMEM;
+		goto fail_nls;
+	}
+	if (sbi->opts.flags & SFS_MNT_CASE)
+		sb->s_root->d_op = &sfs_blk_ci_dentry_ops;
+
+	return 0;
+
+fail_nls:
+	unload_nls(sbi->opts.local_nls);
+	sfs_put_bitmap(sbi->s_bbh, le32_to_cpu(ds->s_block_bitmap_blocks), 0);
+fail_ibh:
+	sfs_put_bitmap(sbi->s_ibh, le32_to_cpu(ds->s_inode_bitmap_blocks), 0);
+fail_sbh:
+	brelse(sbi->s_sbh);
+fail_sbi:
+	sb->s_fs_info = NULL;
+	kfree(sbi);
+	return rv;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,18)
+static struct super_block *sfs_blk_get_sb(struct file_system_type *fs_type,
+	int flags, const char *dev_name, void *data)
+{
+	return get_sb_bdev(fs_type, flags, dev_name, data, sfs_blk_fill_super);
+}
+#else
+static int sfs_blk_get_sb(struct file_system_type *fs_type,
+	int flags, const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_bdev(fs_type, flags, dev_name, data, sfs_blk_fill_super,
+		mnt);
+}
+#endif
+
+static struct file_system_type sfs_blk_fs_type = {
+	.owner = THIS_MODULE,
+	.name = "samplefs_blk",
+	.get_sb = sfs_blk_get_sb,
+	.kill_sb = kill_block_super,
+	.fs_flags = FS_REQUIRES_DEV,
+};
+
+int sfs_blk_init(void)
+{
+	int rv;
+
+	sfs_inode_cachep = kmem_cache_create("sfs_inode_cache",
+		sizeof(struct sfs_inode_info), 0, SLAB_RECLAIM_ACCOUNT,
+		sfs_init_once, NULL);
+	if (!sfs_inode_cachep)
+		return -ENOMEM;
+
+	rv = register_filesystem(&sfs_blk_fs_type);
+	if (rv)
+		kmem_cache_destroy(sfs_inode_cachep);
+
+	return rv;
+}
+
+void sfs_blk_exit(void)
+{
+	unregister_filesystem(&sfs_blk_fs_type);
+	kmem_cache_destroy(sfs_inode_cachep);
+}
@@ -0,0 +1,966 @@
+/*
+ *   fs/samplefs/dir.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample File System
+ *
+ *   Directories of block-backed samplefs, read and written through the
+ *   buffer cache. Names are found through a hash index of at most two
+ *   levels, see samplefs_disk.h, so lookup, insert and delete read three
+ *   blocks at most, whatever the size of the directory.
+ *
+ *   readdir returns entries in hash order, and the position of an entry
+ *   is its hash plus its rank among the names of the same hash, ordered
+ *   by inode and name. Unlike a block offset it doesn't change when a
+ *   leaf is split, so a readdir racing with inserts neither skips nor
+ *   repeats entries, except when a name of the very same hash comes or
+ *   goes in the middle of it.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#include <linux/nls.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include "samplefs.h"
+
+extern struct dentry_operations sfs_blk_ci_dentry_ops;
+
+static unsigned char sfs_dt_type(struct inode *inode)
+{
+	return (inode->i_mode & S_IFMT) >> 12;
+}
+
+/*
+ * Block n of a directory, allocated and zeroed if create is set and it
+ * is new. NULL for a hole.
+ */
+static struct buffer_head *sfs_dir_block(struct inode *dir, unsigned long n,
+		int create)
+{
+	struct buffer_head *bh;
+	unsigned long block;
+	int new, rv;
+
+	rv = sfs_bmap(dir, n, create, &block, &new);
+	if (rv)
+		return ERR_PTR(rv);
+	if (!block)
+		return NULL;
+	if (!new)
+		return sb_bread(dir->i_sb, block);
+
+	bh = sb_getblk(dir->i_sb, block);
+	lock_buffer(bh);
+	memset(bh->b_data, 0, SFS_BLOCK_SIZE);
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+	mark_buffer_dirty_inode(bh, dir);
+
+	return bh;
+}
+
+static int sfs_match(struct super_block *sb, const char *name, int len,
+		struct sfs_dir_entry *de)
+{
+	struct samplefs_sb_info *sfs_sb = SFS_SB(sb);
+
+	if (!de->d_ino || de->d_name_len != len)
+		return 0;
+	if (sfs_sb->flags & SFS_MNT_CASE)
+		return sfs_ci_equal(sfs_sb->local_nls,
+			(const unsigned char *)name,
+			(const unsigned char *)de->d_name, len);
+
+	return !memcmp(name, de->d_name, len);
+}
+
+/*
+ * 31 bit FNV-1a of the name folded to lower case, so that a nocase mount
+ * finds names created on a case sensitive one and vice versa.
+ */
+static u32 sfs_dx_hash(struct super_block *sb, const char *name, int len)
+{
+	struct nls_table *t = SFS_SB(sb)->local_nls;
+	u32 hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= nls_tolower(t, (unsigned char)name[i]);
+		hash *= 16777619U;
+	}
+
+	return hash >> 1;
+}
+
+struct sfs_dx_frame {
+	struct buffer_head *bh;
+	struct sfs_dx_node *node;
+	unsigned int limit;
+	unsigned int at;		/* entry followed to the next level */
+};
+
+static struct sfs_dx_node *sfs_dx_root(struct buffer_head *bh)
+{
+	return (struct sfs_dx_node *)(bh->b_data + 2 * SFS_DIR_ENTRY_SIZE);
+}
+
+static unsigned int sfs_dx_count(struct sfs_dx_frame *f)
+{
+	return le16_to_cpu(f->node->dx_count);
+}
+
+static void sfs_dx_release(struct sfs_dx_frame *frames, int n)
+{
+	while (n--)
+		brelse(frames[n].bh);
+}
+
+/* Last entry with a hash not above hash, entry 0 covers everything below */
+static unsigned int sfs_dx_search(struct sfs_dx_node *node, u32 hash)
+{
+	unsigned int lo = 1, hi = le16_to_cpu(node->dx_count), mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (le32_to_cpu(node->dx_entries[mid].hash) <= hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo - 1;
+}
+
+/*
+ * Walk the index down to the leaf covering hash. Fills in one frame per
+ * level, which the caller releases, and *end with the first hash of the
+ * next leaf, 0 if this is the last one. Returns the leaf's block.
+ */
+static long sfs_dx_probe(struct inode *dir, u32 hash,
+		struct sfs_dx_frame *frames, int *nframes, u32 *end)
+{
+	struct sfs_dx_frame *f = frames;
+	struct buffer_head *bh;
+	struct sfs_dx_node *node;
+	unsigned int levels = 0, count;
+	unsigned long block = 0;
+
+	*nframes = 0;
+	*end = 0;
+
+	bh = sfs_dir_block(dir, 0, 0);
+	node = bh && !IS_ERR(bh) ? sfs_dx_root(bh) : NULL;
+	if (node)
+		levels = node->dx_levels;
+
+	for (;;) {
+		if (!bh || IS_ERR(bh))
+			goto fail;
+		f->bh = bh;
+		f->node = node;
+		f->limit = f == frames ? SFS_DX_ROOT_LIMIT : SFS_DX_NODE_LIMIT;
+		(*nframes)++;
+
+		count = sfs_dx_count(f);
+		if (le32_to_cpu(node->dx_magic) != SFS_DX_MAGIC ||
+		    levels > SFS_DX_MAX_LEVELS || !count || count > f->limit)
+			goto fail;
+
+		f->at = sfs_dx_search(node, hash);
+		if (f->at + 1 < count)
+			*end = le32_to_cpu(node->dx_entries[f->at + 1].hash);
+		block = le32_to_cpu(node->dx_entries[f->at].block);
+		if (f - frames == levels)
+			break;
+
+		bh = sfs_dir_block(dir, block, 0);
+		if (bh && !IS_ERR(bh))
+			node = (struct sfs_dx_node *)bh->b_data;
+		f++;
+	}
+
+	return block;
+
+fail:
+	printk(KERN_ERR "samplefs: bad index in directory %lu\n", dir->i_ino);
+	sfs_dx_release(frames, *nframes);
+	*nframes = 0;
+	return -EIO;
+}
+
+/*
+ * The entry and its buffer, which the caller releases, NULL if there is
+ * no such name, or an ERR_PTR if the directory can't be read. A hole or
+ * an unreadable block where the index points is an error, not a miss.
+ */
+static struct sfs_dir_entry *sfs_find_entry(struct inode *dir,
+		const char *name, int len, struct buffer_head **res)
+{
+	struct sfs_dx_frame frames[SFS_DX_MAX_LEVELS + 1];
+	struct sfs_dir_entry *de;
+	struct buffer_head *bh;
+	long leaf;
+	int i, n;
+	u32 end;
+
+	leaf = sfs_dx_probe(dir, sfs_dx_hash(dir->i_sb, name, len), frames,
+		&n, &end);
+	if (leaf < 0)
+		return ERR_PTR(leaf);
+	sfs_dx_release(frames, n);
+
+	bh = sfs_dir_block(dir, leaf, 0);
+	if (IS_ERR(bh))
+		return ERR_PTR(PTR_ERR(bh));
+	if (!bh)
+		return ERR_PTR(-EIO);
+
+	de = (struct sfs_dir_entry *)bh->b_data;
+	for (i = 0; i < SFS_DIR_ENTRIES; i++) {
+		if (sfs_match(dir->i_sb, name, len, &de[i])) {
+			*res = bh;
+			return &de[i];
+		}
+	}
+	brelse(bh);
+
+	return NULL;
+}
+
+static void sfs_set_entry(struct sfs_dir_entry *de, const char *name,
+		int len, struct inode *inode)
+{
+	memset(de, 0, sizeof(*de));
+	de->d_ino = cpu_to_le32(inode->i_ino);
+	de->d_name_len = len;
+	de->d_type = sfs_dt_type(inode);
+	memcpy(de->d_name, name, len);
+}
+
+/* A zeroed block at the end of the directory */
+static struct buffer_head *sfs_dir_append(struct inode *dir, unsigned long *n)
+{
+	struct buffer_head *bh;
+
+	*n = dir->i_size >> SFS_BLOCK_BITS;
+	bh = sfs_dir_block(dir, *n, 1);
+	if (!IS_ERR(bh)) {
+		i_size_write(dir, (loff_t)(*n + 1) << SFS_BLOCK_BITS);
+		mark_inode_dirty(dir);
+	}
+
+	return bh;
+}
+
+static void sfs_dx_insert_at(struct sfs_dx_frame *f, unsigned int at,
+		u32 hash, unsigned long block)
+{
+	struct sfs_dx_entry *e = &f->node->dx_entries[at];
+	unsigned int count = sfs_dx_count(f);
+
+	memmove(e + 1, e, (count - at) * sizeof(struct sfs_dx_entry));
+	e->hash = cpu_to_le32(hash);
+	e->block = cpu_to_le32(block);
+	f->node->dx_count = cpu_to_le16(count + 1);
+}
+
+/*
+ * Add an index entry for a new leaf right after the one followed by the
+ * probe. A full root moves its entries down into a new index node, which
+ * adds the second level; a full index node is split in two.
+ */
+static int sfs_dx_insert(struct inode *dir, struct sfs_dx_frame *frames,
+		int n, u32 hash, unsigned long block)
+{
+	struct sfs_dx_frame *f = &frames[n - 1], *root = frames, new;
+	unsigned long nb;
+	unsigned int half;
+
+	if (sfs_dx_count(f) < f->limit) {
+		sfs_dx_insert_at(f, f->at + 1, hash, block);
+		mark_buffer_dirty_inode(f->bh, dir);
+		return 0;
+	}
+
+	if (n > 1 && sfs_dx_count(root) >= root->limit)
+		return -ENOSPC;
+
+	new.bh = sfs_dir_append(dir, &nb);
+	if (IS_ERR(new.bh))
+		return PTR_ERR(new.bh);
+	new.node = (struct sfs_dx_node *)new.bh->b_data;
+	new.node->dx_magic = cpu_to_le32(SFS_DX_MAGIC);
+	new.limit = SFS_DX_NODE_LIMIT;
+
+	if (n == 1) {
+		memcpy(new.node->dx_entries, root->node->dx_entries,
+			sfs_dx_count(root) * sizeof(struct sfs_dx_entry));
+		new.node->dx_count = root->node->dx_count;
+		new.at = root->at;
+		root->node->dx_levels = 1;
+		root->node->dx_count = cpu_to_le16(1);
+		root->node->dx_entries[0].hash = 0;
+		root->node->dx_entries[0].block = cpu_to_le32(nb);
+		f = &new;
+	} else {
+		half = sfs_dx_count(f) / 2;
+		memcpy(new.node->dx_entries, &f->node->dx_entries[half],
+			(sfs_dx_count(f) - half) * sizeof(struct sfs_dx_entry));
+		new.node->dx_count = cpu_to_le16(sfs_dx_count(f) - half);
+		f->node->dx_count = cpu_to_le16(half);
+		sfs_dx_insert_at(root, root->at + 1,
+			le32_to_cpu(new.node->dx_entries[0].hash), nb);
+		if (f->at >= half) {
+			new.at = f->at - half;
+			mark_buffer_dirty_inode(f->bh, dir);
+			f = &new;
+		}
+	}
+
+	sfs_dx_insert_at(f, f->at + 1, hash, block);
+	mark_buffer_dirty_inode(root->bh, dir);
+	mark_buffer_dirty_inode(f->bh, dir);
+	mark_buffer_dirty_inode(new.bh, dir);
+	brelse(new.bh);
+
+	return 0;
+}
+
+static int sfs_u32_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Move the upper half of a full leaf, by hash, to a new leaf. All names
+ * of one hash stay in one leaf, so a leaf full of a single hash can't be
+ * split.
+ */
+static int sfs_dx_split(struct inode *dir, struct sfs_dx_frame *frames,
+		int n, struct buffer_head *bh)
+{
+	struct sfs_dir_entry *de = (struct sfs_dir_entry *)bh->b_data, *nde;
+	u32 sorted[SFS_DIR_ENTRIES], split;
+	struct buffer_head *nbh;
+	unsigned long nb;
+	int i, k;
+
+	for (i = 0; i < SFS_DIR_ENTRIES; i++)
+		sorted[i] = sfs_dx_hash(dir->i_sb, de[i].d_name,
+			de[i].d_name_len);
+	sort(sorted, SFS_DIR_ENTRIES, sizeof(u32), sfs_u32_cmp, NULL);
+
+	split = sorted[SFS_DIR_ENTRIES / 2];
+	for (i = SFS_DIR_ENTRIES / 2; split == sorted[0]; i++) {
+		if (i == SFS_DIR_ENTRIES)
+			return -ENOSPC;
+		split = sorted[i];
+	}
+
+	/* A failed insert leaves an unused empty block in the directory */
+	nbh = sfs_dir_append(dir, &nb);
+	if (IS_ERR(nbh))
+		return PTR_ERR(nbh);
+	i = sfs_dx_insert(dir, frames, n, split, nb);
+	if (i) {
+		brelse(nbh);
+		return i;
+	}
+
+	nde = (struct sfs_dir_entry *)nbh->b_data;
+	for (i = 0, k = 0; i < SFS_DIR_ENTRIES; i++) {
+		if (sfs_dx_hash(dir->i_sb, de[i].d_name,
+				de[i].d_name_len) < split)
+			continue;
+		nde[k++] = de[i];
+		memset(&de[i], 0, sizeof(struct sfs_dir_entry));
+	}
+	mark_buffer_dirty_inode(nbh, dir);
+	mark_buffer_dirty_inode(bh, dir);
+	brelse(nbh);
+
+	return 0;
+}
+
+/* Use a free slot of the leaf for the hash, splitting it when full */
+static int sfs_add_entry(struct inode *dir, const char *name, int len,
+		struct inode *inode)
+{
+	struct sfs_dx_frame frames[SFS_DX_MAX_LEVELS + 1];
+	u32 hash = sfs_dx_hash(dir->i_sb, name, len), end;
+	struct sfs_dir_entry *de;
+	struct buffer_head *bh;
+	long leaf;
+	int i, n, rv;
+
+	if (len > SFS_NAME_LEN)
+		return -ENAMETOOLONG;
+
+again:
+	leaf = sfs_dx_probe(dir, hash, frames, &n, &end);
+	if (leaf < 0)
+		return leaf;
+
+	bh = sfs_dir_block(dir, leaf, 0);
+	if (!bh || IS_ERR(bh)) {
+		sfs_dx_release(frames, n);
+		return bh ? PTR_ERR(bh) : -EIO;
+	}
+
+	de = (struct sfs_dir_entry *)bh->b_data;
+	for (i = 0; i < SFS_DIR_ENTRIES; i++)
+		if (!de[i].d_ino)
+			break;
+
+	if (i == SFS_DIR_ENTRIES) {
+		rv = sfs_dx_split(dir, frames, n, bh);
+		sfs_dx_release(frames, n);
+		brelse(bh);
+		if (rv)
+			return rv;
+		goto again;
+	}
+
+	sfs_set_entry(&de[i], name, len, inode);
+	mark_buffer_dirty_inode(bh, dir);
+	sfs_dx_release(frames, n);
+	brelse(bh);
+
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME_SEC;
+	mark_inode_dirty(dir);
+
+	return 0;
+}
+
+static void sfs_delete_entry(struct inode *dir, struct sfs_dir_entry *de,
+		struct buffer_head *bh)
+{
+	de->d_ino = 0;
+	mark_buffer_dirty_inode(bh, dir);
+	brelse(bh);
+
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME_SEC;
+	mark_inode_dirty(dir);
+}
+
+/* "." and "..", and an index root pointing to one empty leaf */
+int sfs_make_empty(struct inode *inode, struct inode *dir)
+{
+	struct buffer_head *bh, *leaf;
+	struct sfs_dir_entry *de;
+	struct sfs_dx_node *root;
+
+	bh = sfs_dir_block(inode, 0, 1);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+	leaf = sfs_dir_block(inode, 1, 1);
+	if (IS_ERR(leaf)) {
+		brelse(bh);
+		return PTR_ERR(leaf);
+	}
+	brelse(leaf);
+
+	de = (struct sfs_dir_entry *)bh->b_data;
+	sfs_set_entry(&de[0], ".", 1, inode);
+	sfs_set_entry(&de[1], "..", 2, dir);
+	root = sfs_dx_root(bh);
+	root->dx_magic = cpu_to_le32(SFS_DX_MAGIC);
+	root->dx_count = cpu_to_le16(1);
+	root->dx_entries[0].block = cpu_to_le32(1);
+	mark_buffer_dirty_inode(bh, inode);
+	brelse(bh);
+
+	i_size_write(inode, 2 * SFS_BLOCK_SIZE);
+	mark_inode_dirty(inode);
+
+	return 0;
+}
+
+/*
+ * 1 if empty, 0 if not, or an error if a block can't be read. Walks the
+ * leaves in hash order, which readdir does too.
+ */
+static int sfs_empty_dir(struct inode *inode)
+{
+	struct sfs_dx_frame frames[SFS_DX_MAX_LEVELS + 1];
+	struct sfs_dir_entry *de;
+	struct buffer_head *bh;
+	u32 hash = 0, end;
+	long leaf;
+	int i, n;
+
+	do {
+		leaf = sfs_dx_probe(inode, hash, frames, &n, &end);
+		if (leaf < 0)
+			return leaf;
+		sfs_dx_release(frames, n);
+
+		bh = sfs_dir_block(inode, leaf, 0);
+		if (IS_ERR(bh))
+			return PTR_ERR(bh);
+		if (!bh)
+			return -EIO;
+
+		de = (struct sfs_dir_entry *)bh->b_data;
+		for (i = 0; i < SFS_DIR_ENTRIES; i++) {
+			if (de[i].d_ino) {
+				brelse(bh);
+				return 0;
+			}
+		}
+		brelse(bh);
+		hash = end;
+	} while (end);
+
+	return 1;
+}
+
+/* ".." is always the second entry of the first block */
+static struct sfs_dir_entry *sfs_dotdot(struct inode *inode,
+		struct buffer_head **res)
+{
+	struct buffer_head *bh = sfs_dir_block(inode, 0, 0);
+
+	if (!bh || IS_ERR(bh))
+		return NULL;
+
+	*res = bh;
+	return (struct sfs_dir_entry *)bh->b_data + 1;
+}
+
+/*
+ * Position of an entry, 0 and 1 are "." and "..". The rank keeps hard
+ * links of one inode under names of the same hash apart, e.g. foo and
+ * Foo on a case sensitive mount, as their hash is case folded.
+ */
+#define SFS_DX_POS(hash, rank)	(((loff_t)(hash) << 32) | (rank))
+#define SFS_DX_EOF		SFS_DX_POS(0x7fffffffU, 0xffffffffU)
+
+struct sfs_dx_pos {
+	loff_t pos;
+	u32 hash;
+	struct sfs_dir_entry *de;
+};
+
+static int sfs_dx_pos_cmp(const void *a, const void *b)
+{
+	const struct sfs_dx_pos *x = a, *y = b;
+	u32 xi = le32_to_cpu(x->de->d_ino), yi = le32_to_cpu(y->de->d_ino);
+	int len = min(x->de->d_name_len, y->de->d_name_len);
+	int rv;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	if (xi != yi)
+		return xi < yi ? -1 : 1;
+	rv = memcmp(x->de->d_name, y->de->d_name, len);
+	if (rv)
+		return rv;
+
+	return x->de->d_name_len - y->de->d_name_len;
+}
+
+static int sfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	struct sfs_dx_frame frames[SFS_DX_MAX_LEVELS + 1];
+	struct inode *dir = filp->f_dentry->d_inode;
+	loff_t pos = filp->f_pos;
+	struct sfs_dir_entry *de;
+	struct sfs_dx_pos *sorted;
+	struct buffer_head *bh;
+	int i, k, n, rv = 0;
+	long leaf;
+	u32 end, rank;
+
+	if (pos == 0) {
+		if (filldir(dirent, ".", 1, 0, dir->i_ino, DT_DIR) < 0)
+			goto out;
+		pos = 1;
+	}
+	if (pos == 1) {
+		if (filldir(dirent, "..", 2, 1,
+				parent_ino(filp->f_dentry), DT_DIR) < 0)
+			goto out;
+		pos = 2;
+	}
+
+	sorted = kmalloc(SFS_DIR_ENTRIES * sizeof(struct sfs_dx_pos),
+		GFP_KERNEL);
+	if (!sorted)
+		return -ENOMEM;
+
+	while (pos < SFS_DX_EOF) {
+		leaf = sfs_dx_probe(dir, pos >> 32, frames, &n, &end);
+		if (leaf < 0) {
+			rv = leaf;
+			break;
+		}
+		sfs_dx_release(frames, n);
+
+		bh = sfs_dir_block(dir, leaf, 0);
+		if (!bh || IS_ERR(bh)) {
+			rv = bh ? PTR_ERR(bh) : -EIO;
+			break;
+		}
+
+		de = (struct sfs_dir_entry *)bh->b_data;
+		for (i = 0, k = 0; i < SFS_DIR_ENTRIES; i++) {
+			if (!de[i].d_ino)
+				continue;
+			sorted[k].hash = sfs_dx_hash(dir->i_sb, de[i].d_name,
+				de[i].d_name_len);
+			sorted[k].de = &de[i];
+			k++;
+		}
+		sort(sorted, k, sizeof(struct sfs_dx_pos), sfs_dx_pos_cmp,
+			NULL);
+
+		/* All names of a hash are in one leaf, so ranks are whole */
+		for (i = 0, rank = 0; i < k; i++) {
+			if (i && sorted[i].hash != sorted[i - 1].hash)
+				rank = 0;
+			sorted[i].pos = SFS_DX_POS(sorted[i].hash, rank++);
+		}
+
+		for (i = 0; i < k; i++) {
+			if (sorted[i].pos < pos)
+				continue;
+			de = sorted[i].de;
+			if (filldir(dirent, de->d_name, de->d_name_len,
+					sorted[i].pos, le32_to_cpu(de->d_ino),
+					de->d_type) < 0) {
+				pos = sorted[i].pos;
+				brelse(bh);
+				goto done;
+			}
+			pos = sorted[i].pos + 1;
+		}
+		brelse(bh);
+
+		pos = end ? SFS_DX_POS(end, 0) : SFS_DX_EOF;
+	}
+done:
+	kfree(sorted);
+out:
+	filp->f_pos = pos;
+	file_accessed(filp);
+
+	return rv;
+}
+
+static struct dentry *sfs_blk_lookup(struct inode *dir, struct dentry *dentry,
+		struct nameidata *nd)
+{
+	struct sfs_dir_entry *de;
+	struct buffer_head *bh;
+	struct inode *inode = NULL;
+	unsigned long ino;
+
+	if (dentry->d_name.len > SFS_NAME_LEN)
+		return ERR_PTR(-ENAMETOOLONG);
+	if (SFS_SB(dir->i_sb)->flags & SFS_MNT_CASE) {
+		dentry->d_op = &sfs_blk_ci_dentry_ops;
+		sfs_ci_cache(dentry, SFS_SB(dir->i_sb)->local_nls);
+	}
+
+	de = sfs_find_entry(dir, dentry->d_name.name, dentry->d_name.len, &bh);
+	if (IS_ERR(de))
+		return ERR_PTR(PTR_ERR(de));
+	if (de) {
+		ino = le32_to_cpu(de->d_ino);
+		brelse(bh);
+		inode = sfs_blk_iget(dir->i_sb, ino);
+		if (IS_ERR(inode))
+			return ERR_PTR(PTR_ERR(inode));
+	}
+
+	d_add(dentry, inode);
+	return NULL;
+}
+
+static int sfs_add_nondir(struct inode *dir, struct dentry *dentry,
+		struct inode *inode)
+{
+	int rv;
+
+	rv = sfs_add_entry(dir, dentry->d_name.name, dentry->d_name.len, inode);
+	if (rv) {
+		inode->i_nlink--;
+		mark_inode_dirty(inode);
+		iput(inode);
+		return rv;
+	}
+
+	d_instantiate(dentry, inode);
+	return 0;
+}
+
+static int sfs_blk_mknod(struct inode *dir, struct dentry *dentry, int mode,
+		dev_t rdev)
+{
+	struct inode *inode = sfs_blk_new_inode(dir, mode, rdev);
+
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	return sfs_add_nondir(dir, dentry, inode);
+}
+
+static int sfs_blk_create(struct inode *dir, struct dentry *dentry, int mode,
+		struct nameidata *nd)
+{
+	return sfs_blk_mknod(dir, dentry, mode | S_IFREG, 0);
+}
+
+static int sfs_blk_symlink(struct inode *dir, struct dentry *dentry,
+		const char *symname)
+{
+	struct inode *inode;
+	int l = strlen(symname) + 1;
+	int rv;
+
+	if (l > SFS_BLOCK_SIZE)
+		return -ENAMETOOLONG;
+
+	inode = sfs_blk_new_inode(dir, S_IFLNK | S_IRWXUGO, 0);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	rv = page_symlink(inode, symname, l);
+	if (rv) {
+		inode->i_nlink--;
+		mark_inode_dirty(inode);
+		iput(inode);
+		return rv;
+	}
+
+	return sfs_add_nondir(dir, dentry, inode);
+}
+
+static int sfs_blk_link(struct dentry *old_dentry, struct inode *dir,
+		struct dentry *dentry)
+{
+	struct inode *inode = old_dentry->d_inode;
+
+	inode->i_ctime = CURRENT_TIME_SEC;
+	inode->i_nlink++;
+	atomic_inc(&inode->i_count);
+	mark_inode_dirty(inode);
+
+	return sfs_add_nondir(dir, dentry, inode);
+}
+
+static int sfs_blk_mkdir(struct inode *dir, struct dentry *dentry, int mode)
+{
+	struct inode *inode;
+	int rv;
+
+	inode = sfs_blk_new_inode(dir, S_IFDIR | mode, 0);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	/* link count is two for dir, for dot and dot dot */
+	inode->i_nlink++;
+	rv = sfs_make_empty(inode, dir);
+	if (!rv)
+		rv = sfs_add_entry(dir, dentry->d_name.name,
+			dentry->d_name.len, inode);
+	if (rv) {
+		inode->i_nlink = 0;
+		mark_inode_dirty(inode);
+		iput(inode);
+		return rv;
+	}
+
+	dir->i_nlink++;
+	mark_inode_dirty(dir);
+	d_instantiate(dentry, inode);
+
+	return 0;
+}
+
+static int sfs_blk_unlink(struct inode *dir, struct dentry *dentry)
+{
+	struct inode *inode = dentry->d_inode;
+	struct sfs_dir_entry *de;
+	struct buffer_head *bh;
+
+	de = sfs_find_entry(dir, dentry->d_name.name, dentry->d_name.len, &bh);
+	if (IS_ERR(de))
+		return PTR_ERR(de);
+	if (!de)
+		return -ENOENT;
+
+	sfs_delete_entry(dir, de, bh);
+	inode->i_ctime = dir->i_ctime;
+	inode->i_nlink--;
+	mark_inode_dirty(inode);
+
+	return 0;
+}
+
+static int sfs_blk_rmdir(struct inode *dir, struct dentry *dentry)
+{
+	struct inode *inode = dentry->d_inode;
+	int rv;
+
+	rv = sfs_empty_dir(inode);
+	if (rv <= 0)
+		return rv ? rv : -ENOTEMPTY;
+
+	rv = sfs_blk_unlink(dir, dentry);
+	if (!rv) {
+		inode->i_size = 0;
+		inode->i_nlink--;
+		mark_inode_dirty(inode);
+		dir->i_nlink--;
+		mark_inode_dirty(dir);
+	}
+
+	return rv;
+}
+
+static int sfs_blk_rename(struct inode *old_dir, struct dentry *old_dentry,
+		struct inode *new_dir, struct dentry *new_dentry)
+{
+	struct inode *old_inode = old_dentry->d_inode;
+	struct inode *new_inode = new_dentry->d_inode;
+	struct buffer_head *old_bh, *new_bh, *dir_bh = NULL;
+	struct sfs_dir_entry *old_de, *new_de, *dir_de = NULL;
+	int rv;
+
+	old_de = sfs_find_entry(old_dir, old_dentry->d_name.name,
+		old_dentry->d_name.len, &old_bh);
+	if (IS_ERR(old_de))
+		return PTR_ERR(old_de);
+	if (!old_de)
+		return -ENOENT;
+
+	if (S_ISDIR(old_inode->i_mode)) {
+		dir_de = sfs_dotdot(old_inode, &dir_bh);
+		if (!dir_de) {
+			rv = -EIO;
+			goto out_old;
+		}
+	}
+
+	if (new_inode) {
+		rv = dir_de ? sfs_empty_dir(new_inode) : 1;
+		if (rv <= 0) {
+			if (!rv)
+				rv = -ENOTEMPTY;
+			goto out_dir;
+		}
+
+		new_de = sfs_find_entry(new_dir, new_dentry->d_name.name,
+			new_dentry->d_name.len, &new_bh);
+		rv = PTR_ERR(new_de);
+		if (IS_ERR(new_de))
+			goto out_dir;
+		rv = -ENOENT;
+		if (!new_de)
+			goto out_dir;
+
+		new_de->d_ino = cpu_to_le32(old_inode->i_ino);
+		new_de->d_type = sfs_dt_type(old_inode);
+		mark_buffer_dirty_inode(new_bh, new_dir);
+		brelse(new_bh);
+		new_dir->i_mtime = new_dir->i_ctime = CURRENT_TIME_SEC;
+		mark_inode_dirty(new_dir);
+
+		new_inode->i_ctime = CURRENT_TIME_SEC;
+		if (dir_de)
+			new_inode->i_nlink--;
+		new_inode->i_nlink--;
+		mark_inode_dirty(new_inode);
+	} else {
+		/*
+		 * Adding the new name can split the leaf holding the old
+		 * entry and move it, so look the old entry up again after
+		 * the insert, as ext3 does for htree directories.
+		 */
+		brelse(old_bh);
+		old_bh = NULL;
+		rv = sfs_add_entry(new_dir, new_dentry->d_name.name,
+			new_dentry->d_name.len, old_inode);
+		if (rv)
+			goto out_dir;
+
+		old_de = sfs_find_entry(old_dir, old_dentry->d_name.name,
+			old_dentry->d_name.len, &old_bh);
+		if (IS_ERR(old_de) || !old_de) {
+			rv = IS_ERR(old_de) ? PTR_ERR(old_de) : -EIO;
+			/* Don't leave the inode under both names */
+			new_de = sfs_find_entry(new_dir,
+				new_dentry->d_name.name,
+				new_dentry->d_name.len, &new_bh);
+			if (!IS_ERR(new_de) && new_de)
+				sfs_delete_entry(new_dir, new_de, new_bh);
+			goto out_dir;
+		}
+		if (dir_de) {
+			new_dir->i_nlink++;
+			mark_inode_dirty(new_dir);
+		}
+	}
+
+	sfs_delete_entry(old_dir, old_de, old_bh);
+
+	old_inode->i_ctime = CURRENT_TIME_SEC;
+	mark_inode_dirty(old_inode);
+	sfs_ci_forget(old_dentry);
+	sfs_ci_forget(new_dentry);
+
+	if (dir_de) {
+		dir_de->d_ino = cpu_to_le32(new_dir->i_ino);
+		mark_buffer_dirty_inode(dir_bh, old_inode);
+		brelse(dir_bh);
+		old_dir->i_nlink--;
+		mark_inode_dirty(old_dir);
+	}
+
+	return 0;
+
+out_dir:
+	if (dir_bh)
+		brelse(dir_bh);
+out_old:
+	brelse(old_bh);
+	return rv;
+}
+
+struct inode_operations sfs_blk_dir_inode_ops = {
+	.create		= sfs_blk_create,
+	.lookup		= sfs_blk_lookup,
+	.link		= sfs_blk_link,
+	.unlink		= sfs_blk_unlink,
+	.symlink	= sfs_blk_symlink,
+	.mkdir		= sfs_blk_mkdir,
+	.rmdir		= sfs_blk_rmdir,
+	.mknod		= sfs_blk_mknod,
+	.rename		= sfs_blk_rename,
+	.getattr	= simple_getattr,
+};
+
+struct file_operations sfs_blk_dir_operations = {
+	.read		= generic_read_dir,
+	.readdir	= sfs_readdir,
+	.fsync		= sfs_sync_file,
+};
@@ -0,0 +1,427 @@
+/*
+ *   fs/samplefs/extents.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample File System
+ *
+ *   Extent map of block-backed samplefs files and directories. Each inode
+ *   keeps its extents sorted by file block in one array, loaded from the
+ *   inode and its extent block at iget time, see samplefs_disk.h. Lookup
+ *   is a binary search, and blocks allocated at the end of an extent just
+ *   make it longer.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/buffer_head.h>
+#include "samplefs.h"
+
+/* Logical blocks are 32 bit on disk */
+#define SFS_MAX_LBLK	0xffffffffULL
+
+static inline u64 sfs_ext_end(struct sfs_ext *e)
+{
+	return (u64)e->lblk + e->len;
+}
+
+/* Index of the first extent ending after iblock, i_ext_count if none */
+static unsigned int sfs_ext_search(struct sfs_inode_info *si, sector_t iblock)
+{
+	unsigned int lo = 0, hi = si->i_ext_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sfs_ext_end(&si->i_ext[mid]) <= iblock)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int sfs_ext_grow(struct sfs_inode_info *si)
+{
+	unsigned int max = min_t(unsigned int, si->i_ext_max * 2,
+		SFS_MAX_EXTENTS);
+	struct sfs_ext *ext;
+
+	/*
+	 * The extent map is one level deep, see samplefs_disk.h, so a file
+	 * this fragmented can't grow even with free blocks left. Say so,
+	 * as ENOSPC alone reads like a full disk.
+	 */
+	if (si->i_ext_max >= SFS_MAX_EXTENTS) {
+		if (printk_ratelimit())
+			printk(KERN_WARNING "samplefs: inode %lu is out of "
+				"extents\n", si->vfs_inode.i_ino);
+		return -ENOSPC;
+	}
+
+	ext = kmalloc(max * sizeof(struct sfs_ext), GFP_NOFS);
+	if (!ext)
+		return -ENOMEM;
+	memcpy(ext, si->i_ext, si->i_ext_count * sizeof(struct sfs_ext));
+	if (si->i_ext != si->i_inline)
+		kfree(si->i_ext);
+	si->i_ext = ext;
+	si->i_ext_max = max;
+
+	return 0;
+}
+
+/* Back to the inline array once the extents fit in there again */
+static void sfs_ext_shrink(struct sfs_inode_info *si)
+{
+	if (si->i_ext == si->i_inline || si->i_ext_count > SFS_INLINE_EXTENTS)
+		return;
+
+	memcpy(si->i_inline, si->i_ext, si->i_ext_count *
+		sizeof(struct sfs_ext));
+	kfree(si->i_ext);
+	si->i_ext = si->i_inline;
+	si->i_ext_max = SFS_INLINE_EXTENTS;
+}
+
+/*
+ * Rewrite the extent block from the in memory extents. It's at most a
+ * few KB, and it only changes when an extent does, so there is no point
+ * in reading it back to update single entries.
+ */
+static void sfs_ext_sync(struct inode *inode)
+{
+	struct sfs_inode_info *si = SFS_I(inode);
+	struct sfs_extent_block *eb;
+	struct buffer_head *bh;
+	unsigned int i;
+
+	if (si->i_ext_count <= SFS_INLINE_EXTENTS)
+		return;
+
+	bh = sb_getblk(inode->i_sb, si->i_ext_block);
+	lock_buffer(bh);
+	memset(bh->b_data, 0, SFS_BLOCK_SIZE);
+	eb = (struct sfs_extent_block *)bh->b_data;
+	eb->eb_magic = cpu_to_le32(SFS_EXT_MAGIC);
+	eb->eb_count = cpu_to_le32(si->i_ext_count - SFS_INLINE_EXTENTS);
+	for (i = SFS_INLINE_EXTENTS; i < si->i_ext_count; i++) {
+		eb->eb_ext[i - SFS_INLINE_EXTENTS].e_lblk =
+			cpu_to_le32(si->i_ext[i].lblk);
+		eb->eb_ext[i - SFS_INLINE_EXTENTS].e_start =
+			cpu_to_le32(si->i_ext[i].start);
+		eb->eb_ext[i - SFS_INLINE_EXTENTS].e_len =
+			cpu_to_le32(si->i_ext[i].len);
+	}
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+	mark_buffer_dirty_inode(bh, inode);
+	brelse(bh);
+}
+
+static void sfs_release_blocks(struct inode *inode, unsigned long block,
+		unsigned long count)
+{
+	sfs_free_blocks(inode->i_sb, block, count);
+	inode->i_blocks -= count << (SFS_BLOCK_BITS - 9);
+}
+
+/*
+ * Add the blocks [start, start + len) at file block lblk, which falls in
+ * the hole before extent i. Merges with the neighbours where both file
+ * and disk blocks are contiguous, which is the common case of appending.
+ */
+static int sfs_ext_add(struct inode *inode, unsigned int i, u32 lblk,
+		u32 start, u32 len)
+{
+	struct sfs_inode_info *si = SFS_I(inode);
+	struct sfs_ext *prev = i ? &si->i_ext[i - 1] : NULL;
+	struct sfs_ext *next = i < si->i_ext_count ? &si->i_ext[i] : NULL;
+	unsigned long n = 1;
+	int rv;
+
+	if (prev && sfs_ext_end(prev) == lblk &&
+	    prev->start + prev->len == start) {
+		prev->len += len;
+		if (next && lblk + len == next->lblk &&
+		    start + len == next->start) {
+			prev->len += next->len;
+			si->i_ext_count--;
+			memmove(next, next + 1, (si->i_ext_count - i) *
+				sizeof(struct sfs_ext));
+		}
+		goto out;
+	}
+
+	if (next && lblk + len == next->lblk && start + len == next->start) {
+		next->lblk = lblk;
+		next->start = start;
+		next->len += len;
+		goto out;
+	}
+
+	if (si->i_ext_count == si->i_ext_max) {
+		rv = sfs_ext_grow(si);
+		if (rv)
+			return rv;
+	}
+
+	if (si->i_ext_count == SFS_INLINE_EXTENTS && !si->i_ext_block) {
+		si->i_ext_block = sfs_new_blocks(inode->i_sb, 0, &n);
+		if (!si->i_ext_block)
+			return -ENOSPC;
+		inode->i_blocks += SFS_BLOCK_SIZE >> 9;
+	}
+
+	memmove(&si->i_ext[i + 1], &si->i_ext[i], (si->i_ext_count - i) *
+		sizeof(struct sfs_ext));
+	si->i_ext[i].lblk = lblk;
+	si->i_ext[i].start = start;
+	si->i_ext[i].len = len;
+	si->i_ext_count++;
+out:
+	sfs_ext_sync(inode);
+	return 0;
+}
+
+/*
+ * Map up to max blocks from file block iblock. Returns the number of
+ * blocks mapped from *block on, 0 for a hole, and allocates the hole, or
+ * as much of it as is free in one run, if create is set. *new is set if
+ * the blocks were allocated. Caller holds i_map_lock.
+ */
+static int __sfs_map_blocks(struct inode *inode, sector_t iblock,
+		unsigned long max, int create, unsigned long *block, int *new)
+{
+	struct sfs_inode_info *si = SFS_I(inode);
+	struct sfs_ext *e, *prev;
+	unsigned long goal = 0, start, n;
+	unsigned int i;
+	int rv;
+
+	*block = 0;
+	*new = 0;
+
+	if (iblock >= SFS_MAX_LBLK)
+		return -EFBIG;
+
+	i = sfs_ext_search(si, iblock);
+	e = &si->i_ext[i];
+	if (i < si->i_ext_count && e->lblk <= iblock) {
+		*block = e->start + (iblock - e->lblk);
+		return min_t(u64, max, sfs_ext_end(e) - iblock);
+	}
+
+	if (!create)
+		return 0;
+
+	/* Fill the hole up to the next extent, next to the extents around */
+	if (i < si->i_ext_count)
+		max = min_t(u64, max, e->lblk - iblock);
+	max = min_t(u64, max, SFS_MAX_LBLK - iblock);
+
+	prev = i ? &si->i_ext[i - 1] : NULL;
+	if (prev)
+		goal = prev->start + (iblock - prev->lblk);
+	else if (i < si->i_ext_count && e->start > e->lblk - iblock)
+		goal = e->start - (e->lblk - iblock);
+
+	n = max;
+	start = sfs_new_blocks(inode->i_sb, goal, &n);
+	if (!start)
+		return -ENOSPC;
+
+	rv = sfs_ext_add(inode, i, iblock, start, n);
+	if (rv) {
+		sfs_free_blocks(inode->i_sb, start, n);
+		return rv;
+	}
+
+	inode->i_blocks += n << (SFS_BLOCK_BITS - 9);
+	mark_inode_dirty(inode);
+
+	*block = start;
+	*new = 1;
+	return n;
+}
+
+int sfs_map_blocks(struct inode *inode, sector_t iblock, unsigned long max,
+		int create, unsigned long *block, int *new)
+{
+	struct sfs_inode_info *si = SFS_I(inode);
+	int rv;
+
+	mutex_lock(&si->i_map_lock);
+	rv = __sfs_map_blocks(inode, iblock, max, create, block, new);
+	mutex_unlock(&si->i_map_lock);
+
+	return rv;
+}
+
+/* One block, *block is 0 for a hole */
+int sfs_bmap(struct inode *inode, sector_t iblock, int create,
+		unsigned long *block, int *new)
+{
+	int rv = sfs_map_blocks(inode, iblock, 1, create, block, new);
+
+	return rv < 0 ? rv : 0;
+}
+
+/* Maps as many blocks as b_size asks for, where they are contiguous */
+int sfs_get_block(struct inode *inode, sector_t iblock,
+		struct buffer_head *bh_result, int create)
+{
+	unsigned long block, max = bh_result->b_size >> SFS_BLOCK_BITS;
+	int new, rv;
+
+	rv = sfs_map_blocks(inode, iblock, max ? max : 1, create, &block,
+		&new);
+	if (rv <= 0)
+		return rv;
+
+	map_bh(bh_result, inode->i_sb, block);
+	bh_result->b_size = rv << SFS_BLOCK_BITS;
+	if (new)
+		set_buffer_new(bh_result);
+
+	return 0;
+}
+
+/* Free the blocks past i_size, after the page cache was cut down */
+void sfs_truncate(struct inode *inode)
+{
+	struct sfs_inode_info *si = SFS_I(inode);
+	struct sfs_ext *e;
+	unsigned long first, n;
+
+	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
+	      S_ISLNK(inode->i_mode)))
+		return;
+
+	block_truncate_page(inode->i_mapping, inode->i_size, sfs_get_block);
+	first = (inode->i_size + SFS_BLOCK_SIZE - 1) >> SFS_BLOCK_BITS;
+
+	mutex_lock(&si->i_map_lock);
+	while (si->i_ext_count) {
+		e = &si->i_ext[si->i_ext_count - 1];
+		if (sfs_ext_end(e) <= first)
+			break;
+
+		n = e->lblk >= first ? e->len : sfs_ext_end(e) - first;
+		sfs_release_blocks(inode, e->start + e->len - n, n);
+		e->len -= n;
+		if (e->len)
+			break;
+		si->i_ext_count--;
+	}
+
+	if (si->i_ext_count > SFS_INLINE_EXTENTS) {
+		sfs_ext_sync(inode);
+	} else if (si->i_ext_block) {
+		bforget(sb_find_get_block(inode->i_sb, si->i_ext_block));
+		sfs_release_blocks(inode, si->i_ext_block, 1);
+		si->i_ext_block = 0;
+	}
+	sfs_ext_shrink(si);
+	mutex_unlock(&si->i_map_lock);
+
+	inode->i_mtime = inode->i_ctime = CURRENT_TIME_SEC;
+	mark_inode_dirty(inode);
+}
+
+/* Fill the extents of a new in core inode from its disk inode */
+int sfs_ext_load(struct inode *inode, struct sfs_disk_inode *di)
+{
+	struct sfs_inode_info *si = SFS_I(inode);
+	unsigned int i, count = le16_to_cpu(di->i_ext_count);
+	struct sfs_extent_block *eb = NULL;
+	struct sfs_extent *de;
+	struct buffer_head *bh = NULL;
+
+	si->i_ext_block = le32_to_cpu(di->i_ext_block);
+	if (count > SFS_MAX_EXTENTS ||
+	    (count > SFS_INLINE_EXTENTS && !si->i_ext_block))
+		goto bad;
+
+	if (count > SFS_INLINE_EXTENTS) {
+		bh = sb_bread(inode->i_sb, si->i_ext_block);
+		if (!bh)
+			return -EIO;
+		eb = (struct sfs_extent_block *)bh->b_data;
+		if (le32_to_cpu(eb->eb_magic) != SFS_EXT_MAGIC ||
+		    le32_to_cpu(eb->eb_count) != count - SFS_INLINE_EXTENTS) {
+			brelse(bh);
+			goto bad;
+		}
+
+		si->i_ext_max = min_t(unsigned int, count * 2,
+			SFS_MAX_EXTENTS);
+		si->i_ext = kmalloc(si->i_ext_max * sizeof(struct sfs_ext),
+			GFP_NOFS);
+		if (!si->i_ext) {
+			si->i_ext = si->i_inline;
+			si->i_ext_max = SFS_INLINE_EXTENTS;
+			brelse(bh);
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		de = i < SFS_INLINE_EXTENTS ? &di->i_ext[i] :
+			&eb->eb_ext[i - SFS_INLINE_EXTENTS];
+		si->i_ext[i].lblk = le32_to_cpu(de->e_lblk);
+		si->i_ext[i].start = le32_to_cpu(de->e_start);
+		si->i_ext[i].len = le32_to_cpu(de->e_len);
+	}
+	si->i_ext_count = count;
+	brelse(bh);
+
+	return 0;
+
+bad:
+	printk(KERN_ERR "samplefs: bad extents in inode %lu\n", inode->i_ino);
+	return -EIO;
+}
+
+/* The inline part, the extent block is kept up to date by sfs_ext_sync */
+void sfs_ext_store(struct inode *inode, struct sfs_disk_inode *di)
+{
+	struct sfs_inode_info *si = SFS_I(inode);
+	unsigned int i;
+
+	mutex_lock(&si->i_map_lock);
+	di->i_ext_block = cpu_to_le32(si->i_ext_block);
+	di->i_ext_count = cpu_to_le16(si->i_ext_count);
+	memset(di->i_ext, 0, sizeof(di->i_ext));
+	for (i = 0; i < min_t(unsigned int, si->i_ext_count,
+			      SFS_INLINE_EXTENTS); i++) {
+		di->i_ext[i].e_lblk = cpu_to_le32(si->i_ext[i].lblk);
+		di->i_ext[i].e_start = cpu_to_le32(si->i_ext[i].start);
+		di->i_ext[i].e_len = cpu_to_le32(si->i_ext[i].len);
+	}
+	mutex_unlock(&si->i_map_lock);
+}
+
+void sfs_ext_free(struct inode *inode)
+{
+	struct sfs_inode_info *si = SFS_I(inode);
+
+	if (si->i_ext != si->i_inline)
+		kfree(si->i_ext);
+	si->i_ext = si->i_inline;
+	si->i_ext_max = SFS_INLINE_EXTENTS;
+	si->i_ext_count = 0;
+	si->i_ext_block = 0;
+}
@@ -0,0 +1,257 @@
+/*
+ *   fs/samplefs/file.c
+ *
+ *   Copyright (C) International Business Machines  Corp., 2006
+ *   Author(s): Steve French (sfrench@us.ibm.com)
+ *
+ *   Sample File System
+ *
+ *   Primitive example to show how to create a Linux filesystem module
+ *
+ *   File struct (file instance) related functions
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#include <linux/mpage.h>
+#include <linux/writeback.h>
+#include "samplefs.h"
+
+/*
+ * A page of the in-memory samplefs is charged against size= when it is
+ * first written, and carries PG_private until it leaves the page cache
+ * again through truncate. Pages that are only read in are zero and free.
+ * A store through a shared mapping never comes through here, see
+ * sfs_file_mmap.
+ */
+static int sfs_prepare_write(struct file *file, struct page *page,
+		unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+
+	if (!PagePrivate(page)) {
+		if (samplefs_charge_blocks(inode->i_sb, 1))
+			return -ENOSPC;
+		SetPagePrivate(page);
+		inode->i_blocks += PAGE_CACHE_SIZE >> 9;
+	}
+
+	return simple_prepare_write(file, page, from, to);
+}
+
+static void sfs_invalidatepage(struct page *page, unsigned long offset)
+{
+	struct inode *inode = page->mapping->host;
+
+	/* Only part of the page was truncated, it stays */
+	if (offset)
+		return;
+
+	ClearPagePrivate(page);
+	inode->i_blocks -= PAGE_CACHE_SIZE >> 9;
+	samplefs_uncharge_blocks(inode->i_sb, 1);
+}
+
+/* The page is the only copy of the data */
+static int sfs_releasepage(struct page *page, gfp_t gfp)
+{
+	return 0;
+}
+
+struct address_space_operations sfs_aops = {
+	.readpage       = simple_readpage,
+	.prepare_write  = sfs_prepare_write,
+	.commit_write   = simple_commit_write,
+	/* PG_private is no buffer, see sfs_prepare_write */
+	.set_page_dirty	= __set_page_dirty_nobuffers,
+	.invalidatepage	= sfs_invalidatepage,
+	.releasepage	= sfs_releasepage,
+};
+
+/*
+ * With size= the page cache can't be written through a shared mapping,
+ * as those pages would never be charged. A read only shared mapping
+ * loses VM_MAYWRITE, so mprotect can't make it writable later.
+ */
+static int sfs_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct samplefs_sb_info *sfs_sb = SFS_SB(file->f_dentry->d_sb);
+
+	if (sfs_sb->max_blocks && (vma->vm_flags & VM_SHARED)) {
+		if (vma->vm_flags & VM_WRITE)
+			return -ENODEV;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	return generic_file_mmap(file, vma);
+}
+
+struct file_operations sfs_file_operations = {
+	.read           = do_sync_read,
+	.aio_read	= generic_file_aio_read,
+	.write          = do_sync_write,
+	.aio_write	= generic_file_aio_write,
+	.mmap           = sfs_file_mmap,
+	.fsync          = simple_sync_file,
+	.sendfile       = generic_file_sendfile,
+	.llseek         = generic_file_llseek,
+};
+
+
+/* Block-backed samplefs, see bsuper.c */
+
+static int sfs_blk_readpage(struct file *file, struct page *page)
+{
+	return block_read_full_page(page, sfs_get_block);
+}
+
+/*
+ * Readahead maps whole extents with one get_block call, and reads each
+ * run of contiguous blocks with a single bio. The generic readahead code
+ * grows the window while reads stay sequential, up to rsize.
+ */
+static int sfs_blk_readpages(struct file *file, struct address_space *mapping,
+		struct list_head *pages, unsigned nr_pages)
+{
+	return mpage_readpages(mapping, pages, nr_pages, sfs_get_block);
+}
+
+static int sfs_blk_writepage(struct page *page, struct writeback_control *wbc)
+{
+	return block_write_full_page(page, sfs_get_block, wbc);
+}
+
+static int sfs_blk_prepare_write(struct file *file, struct page *page,
+		unsigned from, unsigned to)
+{
+	return block_prepare_write(page, from, to, sfs_get_block);
+}
+
+static sector_t sfs_blk_bmap(struct address_space *mapping, sector_t block)
+{
+	return generic_block_bmap(mapping, block, sfs_get_block);
+}
+
+static ssize_t sfs_blk_dio(int rw, struct kiocb *iocb, struct inode *inode,
+		const struct iovec *iov, loff_t offset, unsigned long nr_segs)
+{
+	return blockdev_direct_IO(rw, iocb, inode, inode->i_sb->s_bdev, iov,
+		offset, nr_segs, sfs_get_block, NULL);
+}
+
+/*
+ * Direct I/O goes to the device in pieces of at most rsize or wsize bytes.
+ * They are whole blocks, so an aligned request stays aligned. An async
+ * request completes its kiocb once, so it is issued in one go.
+ */
+static ssize_t sfs_blk_direct_IO(int rw, struct kiocb *iocb,
+		const struct iovec *iov, loff_t offset, unsigned long nr_segs)
+{
+	struct inode *inode = iocb->ki_filp->f_mapping->host;
+	struct samplefs_sb_info *sfs_sb = SFS_SB(inode->i_sb);
+	size_t max = rw == WRITE ? sfs_sb->wsize : sfs_sb->rsize;
+	struct iovec chunk;
+	ssize_t done = 0, rv;
+	unsigned long seg;
+	size_t off;
+
+	if (!is_sync_kiocb(iocb))
+		return sfs_blk_dio(rw, iocb, inode, iov, offset, nr_segs);
+
+	for (seg = 0; seg < nr_segs; seg++) {
+		for (off = 0; off < iov[seg].iov_len; off += rv) {
+			chunk.iov_base = (char __user *)iov[seg].iov_base + off;
+			chunk.iov_len = min(iov[seg].iov_len - off, max);
+			rv = sfs_blk_dio(rw, iocb, inode, &chunk, offset + done,
+				1);
+			if (rv <= 0)
+				return done ? done : rv;
+			done += rv;
+			/* Short at end of file or device */
+			if (rv < chunk.iov_len)
+				return done;
+		}
+	}
+
+	return done;
+}
+
+struct address_space_operations sfs_blk_aops = {
+	.readpage	= sfs_blk_readpage,
+	.readpages	= sfs_blk_readpages,
+	.writepage	= sfs_blk_writepage,
+	.writepages	= sfs_blk_writepages,
+	.sync_page	= block_sync_page,
+	.prepare_write	= sfs_blk_prepare_write,
+	.commit_write	= generic_commit_write,
+	.bmap		= sfs_blk_bmap,
+	.direct_IO	= sfs_blk_direct_IO,
+};
+
+/* Data and indirect blocks first, then the inode itself */
+int sfs_sync_file(struct file *file, struct dentry *dentry, int datasync)
+{
+	struct inode *inode = dentry->d_inode;
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_ALL,
+		.nr_to_write = 0,
+	};
+	int err, rv;
+
+	rv = sync_mapping_buffers(inode->i_mapping);
+	if (!(inode->i_state & I_DIRTY))
+		return rv;
+	if (datasync && !(inode->i_state & I_DIRTY_DATASYNC))
+		return rv;
+
+	err = sync_inode(inode, &wbc);
+	if (!rv)
+		rv = err;
+
+	return rv;
+}
+
+/* The readahead window of the file follows rsize rather than the device */
+static int sfs_blk_file_open(struct inode *inode, struct file *file)
+{
+	struct samplefs_sb_info *sfs_sb = SFS_SB(inode->i_sb);
+
+	if (sfs_sb->flags & SFS_MNT_NORA)
+		file->f_ra.ra_pages = 0;
+	else
+		file->f_ra.ra_pages = sfs_sb->rsize >> PAGE_CACHE_SHIFT;
+
+	return generic_file_open(inode, file);
+}
+
+struct inode_operations sfs_blk_file_inode_ops = {
+	.truncate	= sfs_truncate,
+	.getattr	= simple_getattr,
+};
+
+struct file_operations sfs_blk_file_operations = {
+	.read		= do_sync_read,
+	.aio_read	= generic_file_aio_read,
+	.write		= do_sync_write,
+	.aio_write	= generic_file_aio_write,
+	.mmap		= generic_file_mmap,
+	.fsync		= sfs_sync_file,
+	.sendfile	= generic_file_sendfile,
+	.llseek		= generic_file_llseek,
+	.open		= sfs_blk_file_open,
+};
@@ -0,0 +1,165 @@
+/*
+ *   fs/samplefs/samplefs.h
+ *
+ *   Copyright (C) International Business Machines  Corp., 2006, 2007
+ *   Author(s): Steve French (sfrench@us.ibm.com)
+ *
+ *   Sample File System
+ *
+ *   Primitive example to show how to create a Linux filesystem module
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <linux/spinlock.h>
+#include <linux/percpu_counter.h>
+
+#define SAMPLEFS_ROOT_I 2
+/* samplefs mount flags */
+#define SFS_MNT_CASE 1
+#define SFS_MNT_NORA 2	/* samplefs_blk reads a page at a time */
+
+/* This is an example of filesystem specific mount data that a file system might
+   want to store.  FS per-superblock data varies widely and some fs do not
+   require any information beyond the generic info which is already in
+   struct super_block */
+struct samplefs_sb_info {
+	unsigned int rsize;
+	unsigned int wsize;
+	int flags;
+	struct nls_table *local_nls;
+	/* limits of the in-memory samplefs in pages and inodes, 0 is none */
+	unsigned long max_blocks;
+	unsigned long max_inodes;
+	spinlock_t stat_lock;		/* charges close to a limit */
+	struct percpu_counter used_blocks;
+	struct percpu_counter used_inodes;
+};
+
+static inline struct samplefs_sb_info *
+SFS_SB(struct super_block *sb)
+{
+	return sb->s_fs_info;
+}
+
+#include <linux/mutex.h>
+#include <linux/buffer_head.h>
+#include "samplefs_disk.h"
+
+/* rsize and wsize of samplefs_blk when not given, and their upper bound */
+#define SFS_DEF_IO_SIZE	(128 * 1024)
+#define SFS_MAX_IO_SIZE	(1024 * 1024)
+
+/*
+ * Block-backed samplefs (samplefs_blk) keeps the mount options above, so
+ * SFS_SB works on both, and adds the on-disk metadata it keeps in memory.
+ */
+struct sfs_blk_sb_info {
+	struct samplefs_sb_info opts;
+	struct buffer_head *s_sbh;
+	struct sfs_disk_super *s_ds;
+	struct buffer_head **s_ibh;
+	struct buffer_head **s_bbh;
+	unsigned int s_blocks;
+	unsigned int s_inodes;
+	unsigned int s_first_data;
+	struct mutex s_alloc_lock;	/* bitmaps and free counts */
+};
+
+static inline struct sfs_blk_sb_info *
+SFS_BLK_SB(struct super_block *sb)
+{
+	return sb->s_fs_info;
+}
+
+/* In memory extent, i_ext points to i_inline until it needs more room */
+struct sfs_ext {
+	__u32 lblk;
+	__u32 start;
+	__u32 len;
+};
+
+struct sfs_inode_info {
+	struct sfs_ext *i_ext;
+	unsigned int i_ext_count;
+	unsigned int i_ext_max;
+	__u32 i_ext_block;
+	struct sfs_ext i_inline[SFS_INLINE_EXTENTS];
+	struct mutex i_map_lock;	/* extents of the inode */
+	struct inode vfs_inode;
+};
+
+static inline struct sfs_inode_info *
+SFS_I(struct inode *inode)
+{
+	return container_of(inode, struct sfs_inode_info, vfs_inode);
+}
+
+struct seq_file;
+struct vfsmount;
+
+extern void samplefs_parse_mount_options(char *options,
+		struct samplefs_sb_info *sfs_sb);
+extern int samplefs_show_options(struct seq_file *m, struct vfsmount *mnt);
+extern int samplefs_charge_blocks(struct super_block *sb, long pages);
+extern void samplefs_uncharge_blocks(struct super_block *sb, long pages);
+extern int sfs_ci_equal(struct nls_table *t, const unsigned char *a,
+		const unsigned char *b, unsigned int len);
+extern void sfs_ci_cache(struct dentry *dentry, struct nls_table *t);
+extern void sfs_ci_forget(struct dentry *dentry);
+
+/* bsuper.c */
+extern int sfs_blk_init(void);
+extern void sfs_blk_exit(void);
+extern struct inode *sfs_blk_iget(struct super_block *sb, unsigned long ino);
+extern struct inode *sfs_blk_new_inode(struct inode *dir, int mode,
+		dev_t dev);
+
+/* balloc.c */
+extern unsigned long sfs_new_blocks(struct super_block *sb,
+		unsigned long goal, unsigned long *count);
+extern void sfs_free_blocks(struct super_block *sb, unsigned long block,
+		unsigned long count);
+extern unsigned long sfs_new_ino(struct super_block *sb);
+extern void sfs_free_ino(struct super_block *sb, unsigned long ino);
+
+/* extents.c */
+extern int sfs_ext_load(struct inode *inode, struct sfs_disk_inode *di);
+extern void sfs_ext_store(struct inode *inode, struct sfs_disk_inode *di);
+extern void sfs_ext_free(struct inode *inode);
+extern int sfs_map_blocks(struct inode *inode, sector_t iblock,
+		unsigned long max, int create, unsigned long *block, int *new);
+extern int sfs_bmap(struct inode *inode, sector_t iblock, int create,
+		unsigned long *block, int *new);
+extern int sfs_get_block(struct inode *inode, sector_t iblock,
+		struct buffer_head *bh_result, int create);
+extern void sfs_truncate(struct inode *inode);
+
+/* dir.c */
+extern struct inode_operations sfs_blk_dir_inode_ops;
+extern struct file_operations sfs_blk_dir_operations;
+extern int sfs_make_empty(struct inode *inode, struct inode *dir);
+
+/* file.c */
+extern int sfs_sync_file(struct file *file, struct dentry *dentry,
+		int datasync);
+extern struct address_space_operations sfs_blk_aops;
+extern struct inode_operations sfs_blk_file_inode_ops;
+extern struct file_operations sfs_blk_file_operations;
+
+/* writeback.c */
+extern int sfs_blk_writepages(struct address_space *mapping,
+		struct writeback_control *wbc);
+extern int sfs_wb_show_stats(char *buf);
@@ -0,0 +1,158 @@
+/*
+ *   fs/samplefs/samplefs_disk.h
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample File System
+ *
+ *   On-disk format of block-backed samplefs (samplefs_blk), shared by the
+ *   kernel module and mkfs.samplefs. All fields are little endian.
+ *
+ *   block 0			superblock
+ *   blocks 1 ..		inode bitmap, bit n is inode n
+ *   blocks s_block_bitmap ..	block bitmap, bit n is block n of the disk
+ *   blocks s_inode_table ..	inode table, indexed by inode number
+ *   blocks s_first_data ..	file and directory data
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ */
+
+#ifndef _SAMPLEFS_DISK_H
+#define _SAMPLEFS_DISK_H
+
+#include <linux/types.h>
+
+#define SFS_DISK_MAGIC		0x73666231 /* "sfb1" */
+#define SFS_DISK_VERSION	3
+
+#define SFS_BLOCK_SIZE		4096
+#define SFS_BLOCK_BITS		12
+#define SFS_BITS_PER_BLOCK	(SFS_BLOCK_SIZE * 8)
+
+#define SFS_SUPER_BLOCK		0
+#define SFS_INODE_BITMAP	1
+
+/* Inode 0 means a free directory entry, 1 is reserved, 2 is the root */
+#define SFS_ROOT_INO		2
+#define SFS_FIRST_INO		3
+
+struct sfs_disk_super {
+	__le32 s_magic;
+	__le32 s_version;
+	__le32 s_block_size;
+	__le32 s_blocks;		/* total, metadata included */
+	__le32 s_inodes;		/* size of the inode table */
+	__le32 s_free_blocks;
+	__le32 s_free_inodes;
+	__le32 s_block_bitmap_blocks;
+	__le32 s_inode_table;		/* first block of the inode table */
+	__le32 s_first_data;		/* first block after the metadata */
+	__le32 s_inode_bitmap_blocks;
+	__le32 s_block_bitmap;		/* first block of the block bitmap */
+};
+
+/*
+ * File data is mapped by extents of contiguous blocks, sorted by logical
+ * block. The first SFS_INLINE_EXTENTS live in the inode, the rest in one
+ * extent block pointed to by i_ext_block, so a file written sequentially
+ * needs a single extent however large it grows.
+ *
+ * There is no deeper tree, so a file has at most SFS_MAX_EXTENTS (346
+ * with 4KB blocks) extents. A file fragmented beyond that, e.g. by
+ * random writes into a sparse file or on a nearly full disk, gets ENOSPC
+ * while free blocks are left.
+ */
+struct sfs_extent {
+	__le32 e_lblk;			/* first file block */
+	__le32 e_start;			/* first disk block */
+	__le32 e_len;			/* in blocks */
+};
+
+#define SFS_INLINE_EXTENTS	6
+#define SFS_EXT_MAGIC		0x73666578 /* "sfex" */
+
+struct sfs_extent_block {
+	__le32 eb_magic;
+	__le32 eb_count;
+	struct sfs_extent eb_ext[0];
+};
+
+#define SFS_EXTENTS_PER_BLOCK	((SFS_BLOCK_SIZE - \
+	sizeof(struct sfs_extent_block)) / sizeof(struct sfs_extent))
+#define SFS_MAX_EXTENTS		(SFS_INLINE_EXTENTS + SFS_EXTENTS_PER_BLOCK)
+
+struct sfs_disk_inode {
+	__le16 i_mode;
+	__le16 i_nlink;
+	__le32 i_uid;
+	__le32 i_gid;
+	__le32 i_flags;
+	__le64 i_size;
+	__le32 i_atime;
+	__le32 i_mtime;
+	__le32 i_ctime;
+	__le32 i_blocks;		/* in file system blocks */
+	__le32 i_rdev;			/* special files only */
+	__le32 i_ext_block;
+	__le16 i_ext_count;
+	__le16 i_pad0;
+	struct sfs_extent i_ext[SFS_INLINE_EXTENTS];
+	__u8 i_pad[4];
+};
+
+#define SFS_INODE_SIZE		128
+#define SFS_INODES_PER_BLOCK	(SFS_BLOCK_SIZE / SFS_INODE_SIZE)
+
+/*
+ * Directories are hash indexed. Block 0 holds "." and ".." in its first
+ * two entries and the root of the index after them. Index entries map
+ * the hash of a name to the directory block covering the hashes from
+ * there up to the next entry's; entry 0 covers everything below. With
+ * dx_levels 1 the root points to index nodes, which point to leaves,
+ * otherwise straight to leaves. A leaf is an array of fixed size entries
+ * where d_ino 0 marks a free slot. Entries are found by hash, so they are
+ * never sorted, and a full leaf is split in two by hash.
+ */
+#define SFS_NAME_LEN		58
+
+struct sfs_dir_entry {
+	__le32 d_ino;
+	__u8 d_name_len;
+	__u8 d_type;			/* DT_* */
+	char d_name[SFS_NAME_LEN];
+};
+
+#define SFS_DIR_ENTRY_SIZE	64
+#define SFS_DIR_ENTRIES		(SFS_BLOCK_SIZE / SFS_DIR_ENTRY_SIZE)
+
+#define SFS_DX_MAGIC		0x73666478 /* "sfdx" */
+#define SFS_DX_MAX_LEVELS	1
+
+struct sfs_dx_entry {
+	__le32 hash;
+	__le32 block;			/* block of the directory */
+};
+
+struct sfs_dx_node {
+	__le32 dx_magic;
+	__u8 dx_levels;			/* root only */
+	__u8 dx_pad;
+	__le16 dx_count;
+	struct sfs_dx_entry dx_entries[0];
+};
+
+#define SFS_DX_ROOT_LIMIT	((SFS_BLOCK_SIZE - 2 * SFS_DIR_ENTRY_SIZE - \
+	sizeof(struct sfs_dx_node)) / sizeof(struct sfs_dx_entry))
+#define SFS_DX_NODE_LIMIT	((SFS_BLOCK_SIZE - \
+	sizeof(struct sfs_dx_node)) / sizeof(struct sfs_dx_entry))
+
+#endif /* _SAMPLEFS_DISK_H */
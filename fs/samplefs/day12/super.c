@@ -0,0 +1,711 @@
+/*
+ *   fs/samplefs/super.c
+ *
+ *   Copyright (C) International Business Machines  Corp., 2006
+ *   Author(s): Steve French (sfrench@us.ibm.com)
+ *
+ *   Sample File System
+ *
+ *   Primitive example to show how to create a Linux filesystem module
+ *
+ *   superblock related and misc. functions
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/version.h>
+#include <linux/nls.h>
+#include <linux/proc_fs.h>
+#include <linux/backing-dev.h>
+#include <linux/hash.h>
+#include <linux/rcupdate.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/seq_file.h>
+#include <linux/statfs.h>
+#include <linux/swap.h>
+#include <linux/highmem.h>
+#include "samplefs.h"
+
+/* helpful if this is different than other fs */
+#define SAMPLEFS_MAGIC     0x73616d70 /* "SAMP" */
+
+unsigned int sample_parm = 0;
+module_param(sample_parm, int, 0);
+MODULE_PARM_DESC(sample_parm,"An example parm. Default: x Range: y to z");
+
+extern struct inode_operations sfs_dir_inode_ops;
+extern struct inode_operations sfs_file_inode_ops;
+extern struct file_operations sfs_file_operations;
+extern struct address_space_operations sfs_aops;
+
+static void
+samplefs_put_super(struct super_block *sb)
+{
+	struct samplefs_sb_info *sfs_sb;
+
+        sfs_sb = SFS_SB(sb);
+        if(sfs_sb == NULL) {
+              /* Empty superblock info passed to unmount */
+                return;
+        }
+ 
+	unload_nls(sfs_sb->local_nls);
+ 
+	/* FS-FILLIN your fs specific umount logic here */
+	percpu_counter_destroy(&sfs_sb->used_blocks);
+	percpu_counter_destroy(&sfs_sb->used_inodes);
+
+	kfree(sfs_sb);
+	return;
+}
+
+/*
+ * Pages and inodes are counted per cpu, so writers don't share a cache
+ * line. Far from the limit the approximate count is good enough, close
+ * to it charges take stat_lock and add up the exact count.
+ */
+static int samplefs_charge(struct samplefs_sb_info *sfs_sb,
+		struct percpu_counter *used, unsigned long limit, long n)
+{
+	long slack = FBC_BATCH * num_online_cpus();
+
+	if (limit && percpu_counter_read(used) + n + slack > (long)limit) {
+		spin_lock(&sfs_sb->stat_lock);
+		if (percpu_counter_sum(used) + n > (long)limit) {
+			spin_unlock(&sfs_sb->stat_lock);
+			return -ENOSPC;
+		}
+		percpu_counter_mod(used, n);
+		spin_unlock(&sfs_sb->stat_lock);
+		return 0;
+	}
+
+	percpu_counter_mod(used, n);
+	return 0;
+}
+
+int samplefs_charge_blocks(struct super_block *sb, long pages)
+{
+	struct samplefs_sb_info *sfs_sb = SFS_SB(sb);
+
+	return samplefs_charge(sfs_sb, &sfs_sb->used_blocks,
+		sfs_sb->max_blocks, pages);
+}
+
+void samplefs_uncharge_blocks(struct super_block *sb, long pages)
+{
+	percpu_counter_mod(&SFS_SB(sb)->used_blocks, -pages);
+}
+
+static void samplefs_delete_inode(struct inode *inode)
+{
+	/* Uncharges the pages, see sfs_invalidatepage */
+	truncate_inode_pages(&inode->i_data, 0);
+	percpu_counter_mod(&SFS_SB(inode->i_sb)->used_inodes, -1);
+	clear_inode(inode);
+}
+
+static int samplefs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+	struct samplefs_sb_info *sfs_sb = SFS_SB(dentry->d_sb);
+	long blocks = percpu_counter_sum(&sfs_sb->used_blocks);
+	long inodes = percpu_counter_sum(&sfs_sb->used_inodes);
+
+	buf->f_type = SAMPLEFS_MAGIC;
+	buf->f_bsize = PAGE_CACHE_SIZE;
+	buf->f_namelen = NAME_MAX;
+	/* Like tmpfs, a mount without a limit has no size */
+	if (sfs_sb->max_blocks) {
+		buf->f_blocks = sfs_sb->max_blocks;
+		buf->f_bfree = sfs_sb->max_blocks -
+			min_t(unsigned long, max(blocks, 0L), sfs_sb->max_blocks);
+		buf->f_bavail = buf->f_bfree;
+	}
+	if (sfs_sb->max_inodes) {
+		buf->f_files = sfs_sb->max_inodes;
+		buf->f_ffree = sfs_sb->max_inodes -
+			min_t(unsigned long, max(inodes, 0L), sfs_sb->max_inodes);
+	}
+
+	return 0;
+}
+
+struct super_operations samplefs_super_ops = {
+	.statfs         = samplefs_statfs,
+	.drop_inode     = generic_delete_inode, /* Not needed, is the default */
+	.delete_inode	= samplefs_delete_inode,
+	.put_super      = samplefs_put_super,
+	.show_options	= samplefs_show_options,
+};
+
+void
+samplefs_parse_mount_options(char *options, struct samplefs_sb_info * sfs_sb)
+{
+	char *value;
+	char *data;
+	int size;
+
+	if(!options)
+		return;
+
+	printk(KERN_INFO "samplefs: parsing mount options %s\n", options);
+
+	while ((data = strsep(&options, ",")) != NULL) {
+		if (!*data)
+			continue;
+		if ((value = strchr(data, '=')) != NULL)
+			*value++ = '\0';
+
+		if (strnicmp(data, "rsize", 5) == 0) {
+			if (value && *value) {
+				size = simple_strtoul(value, &value, 0);
+				if(size > 0) {
+					sfs_sb->rsize = size;
+					printk(KERN_INFO
+						"samplefs: rsize %d\n", size);
+				}
+			}
+		} else if (strnicmp(data, "wsize", 5) == 0) {
+			if (value && *value) {
+				size = simple_strtoul(value, &value, 0);
+				if(size > 0) {
+					sfs_sb->wsize = size;
+					printk(KERN_INFO
+						"samplefs: wsize %d\n", size);
+				}
+			}
+		} else if (strnicmp(data, "size", 4) == 0) {
+			if (value && *value) {
+				unsigned long long bytes = memparse(value, &value);
+
+				/* A percentage of RAM, as on tmpfs */
+				if (*value == '%') {
+					bytes <<= PAGE_SHIFT;
+					bytes *= totalram_pages;
+					do_div(bytes, 100);
+				}
+				sfs_sb->max_blocks = (bytes + PAGE_CACHE_SIZE - 1) >>
+					PAGE_CACHE_SHIFT;
+				printk(KERN_INFO "samplefs: size %llu\n", bytes);
+			}
+		} else if (strnicmp(data, "nr_inodes", 9) == 0) {
+			if (value && *value) {
+				sfs_sb->max_inodes = memparse(value, &value);
+				printk(KERN_INFO "samplefs: nr_inodes %lu\n",
+					sfs_sb->max_inodes);
+			}
+		} else if ((strnicmp(data, "nocase", 6) == 0) ||
+			   (strnicmp(data, "ignorecase", 10)  == 0)) {
+			sfs_sb->flags |= SFS_MNT_CASE;
+			printk(KERN_INFO "samplefs: ignore case\n");
+
+		} else if (strnicmp(data, "noreadahead", 11) == 0) {
+			sfs_sb->flags |= SFS_MNT_NORA;
+			printk(KERN_INFO "samplefs: no readahead\n");
+
+		} else {
+			printk(KERN_WARNING "samplefs: bad mount option %s\n",
+				data);
+		} 
+	}
+}
+
+/* Shows up in /proc/mounts, samplefs_blk always has rsize and wsize set */
+int samplefs_show_options(struct seq_file *m, struct vfsmount *mnt)
+{
+	struct samplefs_sb_info *sfs_sb = SFS_SB(mnt->mnt_sb);
+
+	if (sfs_sb->rsize)
+		seq_printf(m, ",rsize=%u", sfs_sb->rsize);
+	if (sfs_sb->wsize)
+		seq_printf(m, ",wsize=%u", sfs_sb->wsize);
+	if (sfs_sb->max_blocks)
+		seq_printf(m, ",size=%luk",
+			sfs_sb->max_blocks << (PAGE_CACHE_SHIFT - 10));
+	if (sfs_sb->max_inodes)
+		seq_printf(m, ",nr_inodes=%lu", sfs_sb->max_inodes);
+	if (sfs_sb->flags & SFS_MNT_CASE)
+		seq_puts(m, ",nocase");
+	if (sfs_sb->flags & SFS_MNT_NORA)
+		seq_puts(m, ",noreadahead");
+
+	return 0;
+}
+
+/*
+ * Case insensitive names are folded and hashed a word at a time. Words
+ * of plain ASCII, which is nearly every name, are folded with a few
+ * arithmetic ops; only words with a non-ASCII byte go through the NLS
+ * table byte by byte. Bytes past the end of a name are zero.
+ */
+#define SFS_ONES	(~0UL / 0xff)
+#define SFS_HIGHS	(SFS_ONES * 0x80)
+
+static inline unsigned long sfs_fold_ascii(unsigned long w)
+{
+	/* High bit of each byte set for 'A' <= byte, and for byte > 'Z' */
+	unsigned long ge_a = w + SFS_ONES * (0x80 - 'A');
+	unsigned long gt_z = w + SFS_ONES * (0x80 - 'Z' - 1);
+
+	return w | ((ge_a & ~gt_z & SFS_HIGHS) >> 2);
+}
+
+static inline unsigned long sfs_fold_word(struct nls_table *t,
+		const unsigned char *name, unsigned int len)
+{
+	unsigned long w = 0;
+	unsigned char *p = (unsigned char *)&w;
+	unsigned int i;
+
+	if (len > sizeof(w))
+		len = sizeof(w);
+	memcpy(&w, name, len);
+	if (!(w & SFS_HIGHS))
+		return sfs_fold_ascii(w);
+
+	for (i = 0; i < len; i++)
+		p[i] = nls_tolower(t, name[i]);
+	return w;
+}
+
+/* Case insensitive equality of two names of length len */
+int sfs_ci_equal(struct nls_table *t, const unsigned char *a,
+		const unsigned char *b, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i += sizeof(unsigned long))
+		if (sfs_fold_word(t, a + i, len - i) !=
+		    sfs_fold_word(t, b + i, len - i))
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Looked up dentries of a nocase mount keep their name folded in
+ * d_fsdata, so a dcache hit folds only the name being looked up.
+ * A rename drops it, as d_move changes the name afterwards.
+ *
+ * d_hash and d_compare run under rcu_read_lock() from __d_lookup, on
+ * dentries that may be on their way to d_release, so they only look at
+ * the superblock and the folded name, which is freed after a grace
+ * period and carries its length in case it's stale.
+ */
+struct sfs_ci_name {
+	struct rcu_head rcu;
+	unsigned int len;
+	unsigned long folded[0];
+};
+
+static void sfs_ci_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct sfs_ci_name, rcu));
+}
+
+static void sfs_ci_set(struct dentry *dentry, struct sfs_ci_name *ci)
+{
+	struct sfs_ci_name *old;
+
+	spin_lock(&dentry->d_lock);
+	old = dentry->d_fsdata;
+	rcu_assign_pointer(dentry->d_fsdata, ci);
+	spin_unlock(&dentry->d_lock);
+
+	if (old)
+		call_rcu(&old->rcu, sfs_ci_free_rcu);
+}
+
+void sfs_ci_cache(struct dentry *dentry, struct nls_table *t)
+{
+	unsigned int i, len = dentry->d_name.len;
+	struct sfs_ci_name *ci;
+
+	ci = kmalloc(sizeof(struct sfs_ci_name) +
+		ALIGN(len, sizeof(unsigned long)), GFP_KERNEL);
+	if (!ci)
+		return;
+	ci->len = len;
+	for (i = 0; i < len; i += sizeof(unsigned long))
+		ci->folded[i / sizeof(unsigned long)] = sfs_fold_word(t,
+			dentry->d_name.name + i, len - i);
+
+	sfs_ci_set(dentry, ci);
+}
+
+void sfs_ci_forget(struct dentry *dentry)
+{
+	sfs_ci_set(dentry, NULL);
+}
+
+static void sfs_ci_release(struct dentry *dentry)
+{
+	struct sfs_ci_name *ci = dentry->d_fsdata;
+
+	if (ci)
+		call_rcu(&ci->rcu, sfs_ci_free_rcu);
+}
+
+static int sfs_ci_hash(struct dentry *dentry, struct qstr *q)
+{
+	struct nls_table *codepage = SFS_SB(dentry->d_sb)->local_nls;
+	unsigned long hash = 0;
+	unsigned int i;
+
+	for (i = 0; i < q->len; i += sizeof(unsigned long))
+		hash = (hash ^ sfs_fold_word(codepage, q->name + i,
+			q->len - i)) * GOLDEN_RATIO_PRIME;
+	q->hash = hash_long(hash ^ q->len, 32);
+
+        return 0;
+}
+
+/*
+ * a is the name of a dentry in the hash chain. Nothing is written, a
+ * match only tells __d_lookup, so compare may run in parallel with
+ * anything, including another compare of the same dentry.
+ */
+static int sfs_ci_compare(struct dentry *dentry, struct qstr *a,
+                           struct qstr *b)
+{
+	struct nls_table *codepage = SFS_SB(dentry->d_sb)->local_nls;
+	struct dentry *child = container_of(a, struct dentry, d_name);
+	unsigned int i, len = a->len;
+	struct sfs_ci_name *ci;
+	int rv = 0;
+
+	if (len != b->len)
+		return 1;
+
+	rcu_read_lock();
+	ci = rcu_dereference(child->d_fsdata);
+	if (ci && ci->len == len) {
+		for (i = 0; i < len; i += sizeof(unsigned long)) {
+			if (ci->folded[i / sizeof(unsigned long)] !=
+			    sfs_fold_word(codepage, b->name + i, len - i)) {
+				rv = 1;
+				break;
+			}
+		}
+		rcu_read_unlock();
+		return rv;
+	}
+	rcu_read_unlock();
+
+	return !sfs_ci_equal(codepage, a->name, b->name, len);
+}
+
+/*
+ * Compare used to copy the new name over a matching negative dentry, so
+ * a file created through it got the case asked for. Instead, a negative
+ * dentry fails revalidation when it's about to be used for a create, and
+ * the create gets a fresh dentry with its own spelling.
+ */
+static int sfs_ci_revalidate(struct dentry *dentry, struct nameidata *nd)
+{
+	if (dentry->d_inode || !nd)
+		return 1;
+
+	return !(nd->flags & LOOKUP_CREATE);
+}
+
+/* No sense hanging on to negative dentries as they are only
+in memory - we are not saving anything as we would for network
+or disk filesystem */
+
+static int sfs_delete_dentry(struct dentry *dentry)
+{
+        return 1;
+}
+
+struct dentry_operations sfs_dentry_ops = {
+	.d_delete = sfs_delete_dentry,
+};
+
+struct dentry_operations sfs_ci_dentry_ops = {
+	.d_revalidate = sfs_ci_revalidate,
+	.d_hash = sfs_ci_hash,
+	.d_compare = sfs_ci_compare,
+	.d_delete = sfs_delete_dentry,
+	.d_release = sfs_ci_release,
+};
+
+/* samplefs_blk keeps its negative dentries, they save a directory scan */
+struct dentry_operations sfs_blk_ci_dentry_ops = {
+	.d_revalidate = sfs_ci_revalidate,
+	.d_hash = sfs_ci_hash,
+	.d_compare = sfs_ci_compare,
+	.d_release = sfs_ci_release,
+};
+
+static struct backing_dev_info sfs_backing_dev_info = {
+	.ra_pages       = 0,    /* No readahead, pages are never on disk */
+	.capabilities   = BDI_CAP_NO_ACCT_DIRTY | BDI_CAP_NO_WRITEBACK |
+			  BDI_CAP_MAP_DIRECT | BDI_CAP_MAP_COPY |
+			  BDI_CAP_READ_MAP | BDI_CAP_WRITE_MAP |
+			  BDI_CAP_EXEC_MAP,
+};
+
+
+/*
+ * Lookup the data, if the dentry didn't already exist, it must be
+ * negative.  Set d_op to delete negative dentries to save memory
+ * (and since it does not help performance for in memory filesystem).
+ */
+
+struct inode *samplefs_get_inode(struct super_block *sb, int mode, dev_t dev)
+{
+        struct inode * inode;
+	struct samplefs_sb_info * sfs_sb = SFS_SB(sb);
+
+	if (samplefs_charge(sfs_sb, &sfs_sb->used_inodes,
+			    sfs_sb->max_inodes, 1))
+		return NULL;
+
+	inode = new_inode(sb);
+	if (!inode)
+		percpu_counter_mod(&sfs_sb->used_inodes, -1);
+        if (inode) {
+                inode->i_mode = mode;
+                inode->i_uid = current->fsuid;
+                inode->i_gid = current->fsgid;
+                inode->i_blocks = 0;
+                inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+		printk(KERN_INFO "about to set inode ops\n");
+		inode->i_mapping->a_ops = &sfs_aops;
+		inode->i_mapping->backing_dev_info = &sfs_backing_dev_info;
+                switch (mode & S_IFMT) {
+                default:
+			init_special_inode(inode, mode, dev);
+			break;
+                case S_IFREG:
+			printk(KERN_INFO "file inode\n");
+			inode->i_op = &sfs_file_inode_ops;
+			inode->i_fop =  &sfs_file_operations;
+			break;
+                case S_IFDIR:
+			printk(KERN_INFO "directory inode sfs_sb: %p\n",sfs_sb);
+			inode->i_op = &sfs_dir_inode_ops;
+			inode->i_fop = &simple_dir_operations;
+
+                        /* link == 2 (for initial ".." and "." entries) */
+                        inode->i_nlink++;
+                        break;
+		case S_IFLNK:
+			inode->i_op = &page_symlink_inode_operations;
+			break;
+                }
+        }
+        return inode;
+	
+}
+
+static int samplefs_fill_super(struct super_block * sb, void * data, int silent)
+{
+	struct inode * inode;
+	struct samplefs_sb_info * sfs_sb;
+
+	sb->s_maxbytes = MAX_LFS_FILESIZE; /* NB: may be too large for mem */
+	sb->s_blocksize = PAGE_CACHE_SIZE;
+	sb->s_blocksize_bits = PAGE_CACHE_SHIFT;
+	sb->s_magic = SAMPLEFS_MAGIC;
+	sb->s_op = &samplefs_super_ops;
+	sb->s_time_gran = 1; /* 1 nanosecond time granularity */
+
+
+	printk(KERN_INFO "samplefs: fill super\n");
+
+#ifdef CONFIG_SAMPLEFS_DEBUG
+	printk(KERN_INFO "samplefs: about to alloc s_fs_info\n");
+#endif
+	sb->s_fs_info = kzalloc(sizeof(struct samplefs_sb_info),GFP_KERNEL);
+	sfs_sb = SFS_SB(sb);
+	if(!sfs_sb) {
+		return -ENOMEM;
+	}
+
+	spin_lock_init(&sfs_sb->stat_lock);
+	percpu_counter_init(&sfs_sb->used_blocks);
+	percpu_counter_init(&sfs_sb->used_inodes);
+
+	/* Same defaults as tmpfs, half of RAM and an inode per page of it */
+	sfs_sb->max_blocks = totalram_pages / 2;
+	sfs_sb->max_inodes = min(totalram_pages - totalhigh_pages,
+				 sfs_sb->max_blocks);
+
+	/* The limits have to be known before the root inode is charged */
+	samplefs_parse_mount_options(data, sfs_sb);
+
+	inode = samplefs_get_inode(sb, S_IFDIR | 0755, 0);
+	if(!inode)
+		goto out_counters;
+	
+	printk(KERN_INFO "samplefs: about to alloc root inode\n");
+
+	sb->s_root = d_alloc_root(inode);
+	if (!sb->s_root) {
+		iput(inode);
+		goto out_counters;
+	}
+	
+	/* below not needed for many fs - but an example of per fs sb data */
+	sfs_sb->local_nls = load_nls_default();
+
+	if (sfs_sb->flags & SFS_MNT_CASE)
+		sb->s_root->d_op = &sfs_ci_dentry_ops;
+	
+	/* FS-FILLIN your filesystem specific mount logic/checks here */
+
+	return 0;
+
+out_counters:
+	percpu_counter_destroy(&sfs_sb->used_blocks);
+	percpu_counter_destroy(&sfs_sb->used_inodes);
+	kfree(sfs_sb);
+	return -ENOMEM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,18)
+struct super_block * samplefs_get_sb(struct file_system_type *fs_type,
+        int flags, const char *dev_name, void *data)
+{
+	return get_sb_nodev(fs_type, flags, data, samplefs_fill_super);
+}
+#else
+int samplefs_get_sb(struct file_system_type *fs_type,
+        int flags, const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_nodev(fs_type, flags, data, samplefs_fill_super, mnt);
+}
+#endif
+
+
+static struct file_system_type samplefs_fs_type = {
+	.owner = THIS_MODULE,
+	.name = "samplefs",
+	.get_sb = samplefs_get_sb,
+	.kill_sb = kill_litter_super,
+	/*  .fs_flags */
+};
+
+#ifdef CONFIG_PROC_FS
+static struct proc_dir_entry *proc_fs_samplefs;
+
+static int
+sfs_debug_read(char *buf, char **beginBuffer, off_t offset,
+                     int count, int *eof, void *data)
+{
+	int length = 0;
+	char * original_buf = buf;
+
+	*beginBuffer = buf + offset;
+
+	length = sprintf(buf,
+                    "Display Debugging Information\n"
+                    "-----------------------------\n");
+
+	buf += length;
+
+	/* FS-FILLIN - add your debug information here */
+	buf += sfs_wb_show_stats(buf);
+
+	length = buf - original_buf;
+	if(offset + count >= length)
+		*eof = 1;
+	if(length < offset) {
+		*eof = 1;
+		return 0;
+	} else {
+		length = length - offset;
+	}
+
+	if (length > count)
+                length = count;
+
+	return length;
+}
+void
+sfs_proc_init(void)
+{
+	proc_fs_samplefs = proc_mkdir("samplefs", proc_root_fs);
+        if (proc_fs_samplefs == NULL)
+                return;
+
+        proc_fs_samplefs->owner = THIS_MODULE;
+	create_proc_read_entry("DebugData", 0, proc_fs_samplefs,
+				sfs_debug_read, NULL);
+}
+
+void
+sfs_proc_clean(void)
+{
+	if (proc_fs_samplefs == NULL)
+		return;
+
+        remove_proc_entry("DebugData", proc_fs_samplefs);
+	remove_proc_entry("samplefs", proc_root_fs);
+}
+#endif /* CONFIG_PROC_FS */
+
+static int __init init_samplefs_fs(void)
+{
+	int rv;
+
+	printk(KERN_INFO "init samplefs\n");
+#ifdef CONFIG_PROC_FS
+	sfs_proc_init();
+#endif
+
+	/* some filesystems pass optional parms at load time */
+	if(sample_parm > 256) {
+		printk("sample_parm %d too large, reset to 10\n", sample_parm);
+		sample_parm = 10;
+	}
+
+	rv = sfs_blk_init();
+	if (rv)
+		goto out;
+
+	rv = register_filesystem(&samplefs_fs_type);
+	if (rv)
+		sfs_blk_exit();
+out:
+#ifdef CONFIG_PROC_FS
+	if (rv)
+		sfs_proc_clean();
+#endif
+	return rv;
+}
+
+static void __exit exit_samplefs_fs(void)
+{
+	printk(KERN_INFO "unloading samplefs\n");
+#ifdef CONFIG_PROC_FS
+	sfs_proc_clean();
+#endif
+	unregister_filesystem(&samplefs_fs_type);
+	sfs_blk_exit();
+	/* folded names still waiting for their grace period */
+	rcu_barrier();
+}
+
+module_init(init_samplefs_fs)
+module_exit(exit_samplefs_fs)
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,301 @@
+/*
+ *   fs/samplefs/writeback.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Sample File System
+ *
+ *   Writeback of block-backed samplefs files. writepages walks the dirty
+ *   pages of a file in index order and puts every page whose block follows
+ *   the one of the page before into the same bio, until the bio holds
+ *   wsize bytes. Pages it can't write that way, e.g. holes dirtied through
+ *   mmap, go through block_write_full_page, which allocates their blocks.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/bio.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/pagevec.h>
+#include <linux/writeback.h>
+#include <linux/backing-dev.h>
+#include <linux/buffer_head.h>
+#include "samplefs.h"
+
+/* Writeback statistics of all samplefs_blk mounts, see DebugData */
+static struct {
+	atomic_long_t passes;		/* writepages calls */
+	atomic_long_t sync_passes;	/* of them WB_SYNC_ALL, e.g. fsync */
+	atomic_long_t bios;
+	atomic_long_t sync_bios;
+	atomic_long_t pages;		/* written by those bios */
+	atomic_long_t single_pages;	/* by block_write_full_page */
+} sfs_wb_stats;
+
+/* The bio being built by one writepages call */
+struct sfs_wb {
+	struct bio *bio;
+	unsigned long next;	/* block that may go next into bio */
+	unsigned int max;	/* pages per bio, from wsize */
+	int sync;
+};
+
+static int sfs_wb_end_io(struct bio *bio, unsigned int bytes_done, int err)
+{
+	const int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
+	struct page *page;
+	int i;
+
+	if (bio->bi_size)
+		return 1;
+
+	/* bi_idx may have been moved by the driver */
+	for (i = 0; i < bio->bi_vcnt; i++) {
+		page = bio->bi_io_vec[i].bv_page;
+		if (!uptodate) {
+			SetPageError(page);
+			if (page->mapping)
+				set_bit(AS_EIO, &page->mapping->flags);
+		}
+		end_page_writeback(page);
+	}
+
+	bio_put(bio);
+	return 0;
+}
+
+static void sfs_wb_submit(struct sfs_wb *wb)
+{
+	if (!wb->bio)
+		return;
+
+	atomic_long_inc(&sfs_wb_stats.bios);
+	if (wb->sync)
+		atomic_long_inc(&sfs_wb_stats.sync_bios);
+	atomic_long_add(wb->bio->bi_vcnt, &sfs_wb_stats.pages);
+
+	submit_bio(WRITE, wb->bio);
+	wb->bio = NULL;
+}
+
+/*
+ * Block of a locked dirty page that can be written as is, or 0. It has
+ * to be inside i_size and mapped, and if it has a buffer, the buffer must
+ * be uptodate, as a page is one block.
+ */
+static unsigned long sfs_wb_block(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	loff_t i_size = i_size_read(inode);
+	pgoff_t end_index = i_size >> PAGE_CACHE_SHIFT;
+	struct buffer_head *bh;
+	unsigned long block;
+	int new;
+
+	if (page->index > end_index ||
+	    (page->index == end_index && !(i_size & ~PAGE_CACHE_MASK)))
+		return 0;
+
+	if (page_has_buffers(page)) {
+		bh = page_buffers(page);
+		if (!buffer_mapped(bh) || !buffer_uptodate(bh))
+			return 0;
+		return bh->b_blocknr;
+	}
+
+	if (sfs_map_blocks(inode, page->index, 1, 0, &block, &new) <= 0)
+		return 0;
+
+	return block;
+}
+
+static int sfs_wb_page(struct sfs_wb *wb, struct page *page,
+		struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	unsigned offset = i_size_read(inode) & ~PAGE_CACHE_MASK;
+	struct buffer_head *bh;
+	unsigned long block;
+	void *kaddr;
+
+	block = sfs_wb_block(page);
+	if (!block) {
+		/* The pages before have to go out first */
+		sfs_wb_submit(wb);
+		atomic_long_inc(&sfs_wb_stats.single_pages);
+		return block_write_full_page(page, sfs_get_block, wbc);
+	}
+
+	if (wb->bio && (block != wb->next || wb->bio->bi_vcnt >= wb->max))
+		sfs_wb_submit(wb);
+
+	if (page->index == i_size_read(inode) >> PAGE_CACHE_SHIFT && offset) {
+		kaddr = kmap_atomic(page, KM_USER0);
+		memset(kaddr + offset, 0, PAGE_CACHE_SIZE - offset);
+		flush_dcache_page(page);
+		kunmap_atomic(kaddr, KM_USER0);
+	}
+
+	if (!wb->bio) {
+		wb->bio = bio_alloc(GFP_NOFS, min_t(unsigned int, wb->max,
+			bio_get_nr_vecs(inode->i_sb->s_bdev)));
+		wb->bio->bi_bdev = inode->i_sb->s_bdev;
+		wb->bio->bi_sector = (sector_t)block << (SFS_BLOCK_BITS - 9);
+		wb->bio->bi_end_io = sfs_wb_end_io;
+	}
+	if (bio_add_page(wb->bio, page, PAGE_CACHE_SIZE, 0) < PAGE_CACHE_SIZE) {
+		/* The device takes less than wsize, start over */
+		sfs_wb_submit(wb);
+		return sfs_wb_page(wb, page, wbc);
+	}
+	wb->next = block + 1;
+
+	if (page_has_buffers(page)) {
+		bh = page_buffers(page);
+		clear_buffer_dirty(bh);
+		if (buffer_heads_over_limit)
+			try_to_free_buffers(page);
+	}
+
+	BUG_ON(PageWriteback(page));
+	set_page_writeback(page);
+	unlock_page(page);
+
+	return 0;
+}
+
+/* Dirty page walk as in mpage_writepages, which builds the bios itself */
+int sfs_blk_writepages(struct address_space *mapping,
+		struct writeback_control *wbc)
+{
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	struct inode *inode = mapping->host;
+	struct sfs_wb wb = {
+		.max = SFS_SB(inode->i_sb)->wsize >> PAGE_CACHE_SHIFT,
+		.sync = wbc->sync_mode == WB_SYNC_ALL,
+	};
+	struct pagevec pvec;
+	pgoff_t index, end;
+	int nr_pages, i, done = 0, scanned = 0, range_whole = 0;
+	int rv = 0;
+
+	/* Pages and blocks have to be the same size */
+	if (PAGE_CACHE_SIZE != SFS_BLOCK_SIZE)
+		return generic_writepages(mapping, wbc);
+
+	if (wbc->nonblocking && bdi_write_congested(bdi)) {
+		wbc->encountered_congestion = 1;
+		return 0;
+	}
+
+	atomic_long_inc(&sfs_wb_stats.passes);
+	if (wb.sync)
+		atomic_long_inc(&sfs_wb_stats.sync_passes);
+
+	pagevec_init(&pvec, 0);
+	if (wbc->range_cyclic) {
+		index = mapping->writeback_index;
+		end = -1;
+	} else {
+		index = wbc->range_start >> PAGE_CACHE_SHIFT;
+		end = wbc->range_end >> PAGE_CACHE_SHIFT;
+		if (wbc->range_start == 0 && wbc->range_end == LLONG_MAX)
+			range_whole = 1;
+		scanned = 1;
+	}
+
+retry:
+	while (!done && index <= end &&
+	       (nr_pages = pagevec_lookup_tag(&pvec, mapping, &index,
+			PAGECACHE_TAG_DIRTY,
+			min(end - index, (pgoff_t)PAGEVEC_SIZE - 1) + 1))) {
+		scanned = 1;
+		for (i = 0; i < nr_pages; i++) {
+			struct page *page = pvec.pages[i];
+
+			lock_page(page);
+			if (page->mapping != mapping) {
+				unlock_page(page);
+				continue;
+			}
+			if (!wbc->range_cyclic && page->index > end) {
+				done = 1;
+				unlock_page(page);
+				continue;
+			}
+
+			if (wbc->sync_mode != WB_SYNC_NONE)
+				wait_on_page_writeback(page);
+			if (PageWriteback(page) ||
+			    !clear_page_dirty_for_io(page)) {
+				unlock_page(page);
+				continue;
+			}
+
+			rv = sfs_wb_page(&wb, page, wbc);
+			if (rv)
+				set_bit(rv == -ENOSPC ? AS_ENOSPC : AS_EIO,
+					&mapping->flags);
+			if (rv || --wbc->nr_to_write <= 0)
+				done = 1;
+			if (wbc->nonblocking && bdi_write_congested(bdi)) {
+				wbc->encountered_congestion = 1;
+				done = 1;
+			}
+		}
+		pagevec_release(&pvec);
+		cond_resched();
+	}
+	if (!scanned && !done) {
+		/* Hit the end of the file, wrap around to the start */
+		scanned = 1;
+		index = 0;
+		goto retry;
+	}
+	if (wbc->range_cyclic || (range_whole && wbc->nr_to_write > 0))
+		mapping->writeback_index = index;
+
+	sfs_wb_submit(&wb);
+
+	return rv;
+}
+
+/* Averages are printed with one decimal */
+static unsigned long sfs_wb_ratio10(long a, long b)
+{
+	return b ? a * 10 / b : 0;
+}
+
+int sfs_wb_show_stats(char *buf)
+{
+	long passes = atomic_long_read(&sfs_wb_stats.passes);
+	long sync_passes = atomic_long_read(&sfs_wb_stats.sync_passes);
+	long bios = atomic_long_read(&sfs_wb_stats.bios);
+	long sync_bios = atomic_long_read(&sfs_wb_stats.sync_bios);
+	long pages = atomic_long_read(&sfs_wb_stats.pages);
+	unsigned long ppb = sfs_wb_ratio10(pages, bios);
+	unsigned long bps = sfs_wb_ratio10(sync_bios, sync_passes);
+
+	return sprintf(buf,
+		"samplefs_blk writeback\n"
+		"passes: %ld sync: %ld\n"
+		"bios: %ld sync: %ld\n"
+		"pages: %ld single pages: %ld\n"
+		"pages per bio: %lu.%lu\n"
+		"bios per sync: %lu.%lu\n",
+		passes, sync_passes, bios, sync_bios, pages,
+		atomic_long_read(&sfs_wb_stats.single_pages),
+		ppb / 10, ppb % 10, bps / 10, bps % 10);
+}
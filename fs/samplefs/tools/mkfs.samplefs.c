@@ -0,0 +1,205 @@
+/*
+ *   fs/samplefs/tools/mkfs.samplefs.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Create an empty block-backed samplefs (samplefs_blk) on a device or
+ *   an image file, sized to the whole device. -i sets the number of
+ *   inodes, by default one per 4 blocks.
+ *
+ *   The root directory is an index root in its first block, pointing to
+ *   an empty leaf in the second one.
+ *
+ *	truncate -s 64M /tmp/sfs.img
+ *	mkfs.samplefs /tmp/sfs.img
+ *	mount -t samplefs_blk -o loop /tmp/sfs.img /mnt/test
+ *
+ *   samplefs_blk is built on the 2.6.18 VFS of day12, and sampleblk day3
+ *   on a 4.6 block layer, so the two can't be loaded into one kernel. A
+ *   loop device or a real disk is what samplefs_blk mounts in practice.
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "samplefs_disk.h"
+
+static unsigned char block[SFS_BLOCK_SIZE];
+
+static void set_bit(unsigned char *map, unsigned long n)
+{
+	map[n / 8] |= 1 << (n % 8);
+}
+
+static int write_block(int fd, unsigned long nr)
+{
+	if (pwrite(fd, block, SFS_BLOCK_SIZE,
+		   (off_t)nr * SFS_BLOCK_SIZE) != SFS_BLOCK_SIZE) {
+		perror("pwrite");
+		return -1;
+	}
+	memset(block, 0, SFS_BLOCK_SIZE);
+
+	return 0;
+}
+
+static void add_dirent(struct sfs_dir_entry *de, uint32_t ino,
+		const char *name)
+{
+	de->d_ino = htole32(ino);
+	de->d_name_len = strlen(name);
+	de->d_type = 4;		/* DT_DIR */
+	memcpy(de->d_name, name, de->d_name_len);
+}
+
+int main(int argc, char **argv)
+{
+	struct sfs_disk_super *ds = (struct sfs_disk_super *)block;
+	struct sfs_disk_inode *di;
+	unsigned long blocks, inodes = 0, ibh, bbh, itable, first_data, i, bit;
+	struct sfs_dx_node *root;
+	uint64_t size;
+	struct stat st;
+	int fd;
+
+	if (argc == 4 && !strcmp(argv[1], "-i")) {
+		inodes = strtoul(argv[2], NULL, 0);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "usage: mkfs.samplefs [-i inodes] <device or image>\n");
+		return 1;
+	}
+
+	fd = open(argv[1], O_RDWR);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &size)) {
+			perror("BLKGETSIZE64");
+			return 1;
+		}
+	} else {
+		size = st.st_size;
+	}
+
+	blocks = size >> SFS_BLOCK_BITS;
+	if (blocks > UINT32_MAX)
+		blocks = UINT32_MAX;
+	if (!inodes)
+		inodes = blocks / 4;
+	inodes = (inodes + SFS_INODES_PER_BLOCK - 1) /
+		SFS_INODES_PER_BLOCK * SFS_INODES_PER_BLOCK;
+	if (inodes > UINT32_MAX / SFS_INODES_PER_BLOCK * SFS_INODES_PER_BLOCK)
+		inodes = UINT32_MAX / SFS_INODES_PER_BLOCK * SFS_INODES_PER_BLOCK;
+	if (inodes <= SFS_FIRST_INO)
+		inodes = SFS_INODES_PER_BLOCK;
+
+	ibh = (inodes + SFS_BITS_PER_BLOCK - 1) / SFS_BITS_PER_BLOCK;
+	bbh = (blocks + SFS_BITS_PER_BLOCK - 1) / SFS_BITS_PER_BLOCK;
+	itable = SFS_INODE_BITMAP + ibh + bbh;
+	first_data = itable + inodes / SFS_INODES_PER_BLOCK;
+	if (first_data + 2 > blocks) {
+		fprintf(stderr, "%s: %llu bytes is too small\n", argv[1],
+			(unsigned long long)size);
+		return 1;
+	}
+
+	/* The root directory takes the first two data blocks */
+	ds->s_magic = htole32(SFS_DISK_MAGIC);
+	ds->s_version = htole32(SFS_DISK_VERSION);
+	ds->s_block_size = htole32(SFS_BLOCK_SIZE);
+	ds->s_blocks = htole32(blocks);
+	ds->s_inodes = htole32(inodes);
+	ds->s_free_blocks = htole32(blocks - first_data - 2);
+	ds->s_free_inodes = htole32(inodes - SFS_FIRST_INO);
+	ds->s_block_bitmap_blocks = htole32(bbh);
+	ds->s_inode_table = htole32(itable);
+	ds->s_first_data = htole32(first_data);
+	ds->s_inode_bitmap_blocks = htole32(ibh);
+	ds->s_block_bitmap = htole32(SFS_INODE_BITMAP + ibh);
+	if (write_block(fd, SFS_SUPER_BLOCK))
+		return 1;
+
+	for (i = 0; i < SFS_FIRST_INO; i++)
+		set_bit(block, i);
+	for (i = 0; i < ibh; i++)
+		if (write_block(fd, SFS_INODE_BITMAP + i))
+			return 1;
+
+	/* Bits of the metadata, the root directory and beyond the disk */
+	for (i = 0; i < bbh; i++) {
+		for (bit = 0; bit < SFS_BITS_PER_BLOCK; bit++) {
+			unsigned long n = i * SFS_BITS_PER_BLOCK + bit;
+
+			if (n <= first_data + 1 || n >= blocks)
+				set_bit(block, bit);
+		}
+		if (write_block(fd, SFS_INODE_BITMAP + ibh + i))
+			return 1;
+	}
+
+	for (i = itable; i < first_data; i++) {
+		if (i == itable + SFS_ROOT_INO / SFS_INODES_PER_BLOCK) {
+			di = (struct sfs_disk_inode *)block +
+				SFS_ROOT_INO % SFS_INODES_PER_BLOCK;
+			di->i_mode = htole16(S_IFDIR | 0755);
+			di->i_nlink = htole16(2);
+			di->i_uid = htole32(getuid());
+			di->i_gid = htole32(getgid());
+			di->i_size = htole64(2 * SFS_BLOCK_SIZE);
+			di->i_atime = di->i_mtime = di->i_ctime =
+				htole32(time(NULL));
+			di->i_blocks = htole32(2);
+			di->i_ext_count = htole16(1);
+			di->i_ext[0].e_lblk = 0;
+			di->i_ext[0].e_start = htole32(first_data);
+			di->i_ext[0].e_len = htole32(2);
+		}
+		if (write_block(fd, i))
+			return 1;
+	}
+
+	add_dirent((struct sfs_dir_entry *)block, SFS_ROOT_INO, ".");
+	add_dirent((struct sfs_dir_entry *)block + 1, SFS_ROOT_INO, "..");
+	root = (struct sfs_dx_node *)(block + 2 * SFS_DIR_ENTRY_SIZE);
+	root->dx_magic = htole32(SFS_DX_MAGIC);
+	root->dx_count = htole16(1);
+	root->dx_entries[0].block = htole32(1);
+	if (write_block(fd, first_data) || write_block(fd, first_data + 1))
+		return 1;
+
+	if (fsync(fd)) {
+		perror("fsync");
+		return 1;
+	}
+
+	printf("%s: %lu blocks of %d bytes, %lu inodes, data from block %lu\n",
+	       argv[1], blocks, SFS_BLOCK_SIZE, inodes, first_data);
+	close(fd);
+
+	return 0;
+}
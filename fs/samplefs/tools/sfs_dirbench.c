@@ -0,0 +1,195 @@
+/*
+ *   fs/samplefs/tools/sfs_dirbench.c
+ *
+ *   Copyright (C) Oliver Yang 2016
+ *   Author(s): Yong Yang (yangoliver@gmail.com)
+ *
+ *   Directory benchmark: create n empty files in one directory, stat
+ *   them in random order, read the directory back, and unlink them,
+ *   reporting the rate of each phase. A million entries needs about a
+ *   million inodes and 1GB, e.g. on a loop device:
+ *
+ *	truncate -s 2G /tmp/sfs.img
+ *	mkfs.samplefs -i 1100000 /tmp/sfs.img
+ *	mount -t samplefs_blk -o loop /tmp/sfs.img /mnt/test
+ *	sfs_dirbench /mnt/test/big 1000000
+ *
+ *   -r repeats the stat phase that many times with the dcache hot, which
+ *   is all d_hash and d_compare, and -u stats the names in upper case, so
+ *   running it on a nocase and a default mount compares the two:
+ *
+ *	mount -t samplefs -o nocase none /mnt/ci
+ *	sfs_dirbench -r 10 -u /mnt/ci/d 100000
+ *	sfs_dirbench -r 10 /mnt/ci/d 100000
+ *	mount -t samplefs none /mnt/cs
+ *	sfs_dirbench -r 10 /mnt/cs/d 100000
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU Lesser General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *phase, unsigned long n,
+		unsigned long long start)
+{
+	double secs = (now_ns() - start) / 1e9;
+
+	printf("%-8s %10lu ops %10.3f s %12.0f ops/s\n", phase, n, secs,
+	       secs > 0 ? n / secs : 0);
+}
+
+static int upper;
+
+static void name(char *buf, unsigned long i)
+{
+	sprintf(buf, upper ? "FILE%08lu" : "file%08lu", i);
+}
+
+static int stat_all(unsigned long n, unsigned long *order)
+{
+	struct stat st;
+	char buf[32];
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		name(buf, order[i]);
+		if (stat(buf, &st)) {
+			perror(buf);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long n, i, j, t, *order, found = 0, rounds = 0;
+	unsigned long long start;
+	struct dirent *d;
+	char buf[32];
+	DIR *dir;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "r:u")) != -1) {
+		switch (c) {
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			upper = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+	if (argc != 3) {
+usage:
+		fprintf(stderr,
+			"usage: sfs_dirbench [-r rounds] [-u] <dir> <entries>\n");
+		return 1;
+	}
+	n = strtoul(argv[2], NULL, 0);
+
+	if (mkdir(argv[1], 0755) || chdir(argv[1])) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	order = malloc(n * sizeof(*order));
+	if (!order)
+		return 1;
+	srandom(1);
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n; i > 1; i--) {
+		j = random() % i;
+		t = order[i - 1];
+		order[i - 1] = order[j];
+		order[j] = t;
+	}
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		sprintf(buf, "file%08lu", i);
+		fd = open(buf, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (fd < 0) {
+			perror(buf);
+			return 1;
+		}
+		close(fd);
+	}
+	report("create", n, start);
+
+	/* Drop the dentries, so lookups go to the directory index */
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "2", 1) != 1)
+		fprintf(stderr, "can't drop caches, stat hits the dcache\n");
+	if (fd >= 0)
+		close(fd);
+
+	start = now_ns();
+	if (stat_all(n, order))
+		return 1;
+	report("stat", n, start);
+
+	start = now_ns();
+	for (i = 0; i < rounds; i++)
+		if (stat_all(n, order))
+			return 1;
+	if (rounds)
+		report("stat-hot", n * rounds, start);
+
+	start = now_ns();
+	dir = opendir(".");
+	while (dir && (d = readdir(dir)))
+		if (d->d_name[0] != '.')
+			found++;
+	if (dir)
+		closedir(dir);
+	report("readdir", found, start);
+	if (found != n)
+		fprintf(stderr, "readdir found %lu of %lu entries\n", found, n);
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		sprintf(buf, "file%08lu", order[i]);
+		if (unlink(buf)) {
+			perror(buf);
+			return 1;
+		}
+	}
+	report("unlink", n, start);
+
+	if (chdir("..") || rmdir(argv[1]))
+		perror(argv[1]);
+
+	return found != n;
+}